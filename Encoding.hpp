@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+/**
+ * @brief The binary encodings shared by ModelStream, MappedStorage and
+ *        SharedRowCache. Internal to the library.
+ */
+class Encoding
+{
+public:
+    /**
+     * @brief Appends an unsigned integer as a varint: 7 bits per byte, least
+     *        significant first, with the high bit set on every byte but the last.
+     */
+    static void putVarint(QByteArray& out, quint64 value)
+    {
+        while (value >= 0x80) {
+            out.append(char(value | 0x80));
+            value >>= 7;
+        }
+
+        out.append(char(value));
+    }
+
+    /**
+     * @brief Maps a signed integer to an unsigned one, interleaving the negative and
+     *        positive values so small magnitudes stay short varints.
+     */
+    static quint64 zigzag(qint64 value)
+    {
+        return (quint64(value) << 1) ^ quint64(value >> 63);
+    }
+
+    /**
+     * @brief Reverses zigzag.
+     */
+    static qint64 unzigzag(quint64 value)
+    {
+        return qint64(value >> 1) ^ -qint64(value & 1);
+    }
+
+    /**
+     * @brief Hashes the bytes with 64 bit FNV-1a. Unlike qHash, which is seeded
+     *        differently in each process, the hash is stable.
+     */
+    static quint64 fnv1a(QByteArrayView bytes)
+    {
+        quint64 hash = 14695981039346656037ULL;
+
+        for (char byte : bytes) {
+            hash ^= quint8(byte);
+            hash *= 1099511628211ULL;
+        }
+
+        return hash;
+    }
+};
@@ -0,0 +1,665 @@
+#include <cstring>
+#include <utility>
+#include <QDate>
+#include <QDebug>
+#include <QtEndian>
+#include <QSaveFile>
+#include <QDataStream>
+#include <zlib.h>
+#include "MappedStorage.hpp"
+#include "Encoding.hpp"
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Every record starts with the size of its body and the CRC-32 of the body
+constexpr qint64 headerSize = 2 * sizeof(quint32);
+
+// Compact once superseded records take more than half of a file at least this big
+constexpr qint64 compactionThreshold = 4 * 1024 * 1024;
+
+// The type of each value of a Put record, followed by its data if any
+enum ValueTag : quint8 { Null, False, True, Signed, Unsigned, Double, String, Bytes, Date, Other };
+
+void putBytes(QByteArray& out, const QByteArray& bytes)
+{
+    Encoding::putVarint(out, quint64(bytes.size()));
+    out.append(bytes);
+}
+
+quint32 checksum(const void* data, qint64 size)
+{
+    return quint32(crc32(crc32(0L, Z_NULL, 0), static_cast<const Bytef*>(data), uInt(size)));
+}
+
+void putValue(QByteArray& out, const QVariant& value)
+{
+    if (!value.isValid() || value.isNull()) {
+        out.append(char(Null));
+        return;
+    }
+
+    switch (value.typeId()) {
+    case QMetaType::Bool:
+        out.append(char(value.toBool() ? True : False));
+        return;
+    case QMetaType::Char:
+    case QMetaType::SChar:
+    case QMetaType::Short:
+    case QMetaType::Int:
+    case QMetaType::Long:
+    case QMetaType::LongLong:
+        out.append(char(Signed));
+        Encoding::putVarint(out, Encoding::zigzag(value.toLongLong()));
+        return;
+    case QMetaType::UChar:
+    case QMetaType::UShort:
+    case QMetaType::UInt:
+    case QMetaType::ULong:
+    case QMetaType::ULongLong:
+        out.append(char(Unsigned));
+        Encoding::putVarint(out, value.toULongLong());
+        return;
+    case QMetaType::Float:
+    case QMetaType::Double: {
+        double number = value.toDouble();
+        quint64 bits;
+        std::memcpy(&bits, &number, sizeof(bits));
+        out.append(char(Double));
+        out.append(QByteArray(sizeof(bits), Qt::Uninitialized));
+        qToLittleEndian<quint64>(bits, out.data() + out.size() - sizeof(bits));
+        return;
+    }
+    case QMetaType::QString:
+        out.append(char(String));
+        putBytes(out, value.toString().toUtf8());
+        return;
+    case QMetaType::QByteArray:
+        out.append(char(Bytes));
+        putBytes(out, value.toByteArray());
+        return;
+    case QMetaType::QDate:
+        out.append(char(Date));
+        Encoding::putVarint(out, Encoding::zigzag(value.toDate().toJulianDay()));
+        return;
+    default: {
+        QByteArray bytes;
+        QDataStream stream(&bytes, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_6_0);
+        stream << value;
+        out.append(char(Other));
+        putBytes(out, bytes);
+        return;
+    }
+    }
+}
+
+/**
+ * @brief Reads the fields of a record body, checking every read against its end.
+ */
+struct RecordReader
+{
+    const uchar* data;
+    qint64 size;
+    qint64 position;
+
+    bool varint(quint64& value)
+    {
+        value = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (position >= size)
+                return false;
+
+            uchar byte = data[position++];
+            value |= quint64(byte & 0x7f) << shift;
+
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+
+        return false;
+    }
+
+    bool bytes(QByteArray& value)
+    {
+        quint64 length = 0;
+
+        if (!varint(length) || length > quint64(size - position))
+            return false;
+
+        value = QByteArray(reinterpret_cast<const char*>(data + position), qsizetype(length));
+        position += qint64(length);
+        return true;
+    }
+
+    bool readValue(QVariant& value)
+    {
+        if (position >= size)
+            return false;
+
+        quint8 tag = data[position++];
+        quint64 number = 0;
+        QByteArray buffer;
+
+        switch (tag) {
+        case Null:
+            value = QVariant();
+            return true;
+        case False:
+        case True:
+            value = QVariant(tag == True);
+            return true;
+        case Signed:
+            if (!varint(number))
+                return false;
+
+            value = qlonglong(Encoding::unzigzag(number));
+            return true;
+        case Unsigned:
+            if (!varint(number))
+                return false;
+
+            value = qulonglong(number);
+            return true;
+        case Double: {
+            if (position + qint64(sizeof(quint64)) > size)
+                return false;
+
+            quint64 bits = qFromLittleEndian<quint64>(data + position);
+            double real;
+            std::memcpy(&real, &bits, sizeof(real));
+            position += sizeof(quint64);
+            value = real;
+            return true;
+        }
+        case String:
+            if (!bytes(buffer))
+                return false;
+
+            value = QString::fromUtf8(buffer);
+            return true;
+        case Bytes:
+            if (!bytes(buffer))
+                return false;
+
+            value = buffer;
+            return true;
+        case Date:
+            if (!varint(number))
+                return false;
+
+            value = QDate::fromJulianDay(Encoding::unzigzag(number));
+            return true;
+        case Other: {
+            if (!bytes(buffer))
+                return false;
+
+            QDataStream stream(buffer);
+            stream.setVersion(QDataStream::Qt_6_0);
+            stream >> value;
+            return stream.status() == QDataStream::Ok;
+        }
+        default:
+            return false;
+        }
+    }
+};
+
+QByteArray schemaPayload(const QString& tableName, const QStringList& columns)
+{
+    QByteArray payload;
+    putBytes(payload, tableName.toUtf8());
+    Encoding::putVarint(payload, quint64(columns.size()));
+
+    for (const QString& column : columns)
+        putBytes(payload, column.toUtf8());
+
+    return payload;
+}
+
+}
+
+MappedStorage::MappedStorage(const QString& fileName, bool syncWrites)
+    : m_fileName{fileName}
+    , m_syncWrites{syncWrites}
+{
+}
+
+MappedStorage::~MappedStorage()
+{
+    close();
+}
+
+bool MappedStorage::open()
+{
+    QMutexLocker locker(&m_mutex);
+    close();
+    m_file.setFileName(m_fileName);
+
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        qCritical() << "Could not open storage file:" << m_file.errorString();
+        return false;
+    }
+
+    return replay();
+}
+
+bool MappedStorage::compact()
+{
+    QMutexLocker locker(&m_mutex);
+    return compactFile();
+}
+
+bool MappedStorage::insert(const QString& table, const QVariantHash& row, model_id_t& id)
+{
+    QMutexLocker locker(&m_mutex);
+    Table& rows = m_tables[table];
+
+    if (!put(rows, table, rows.lastId + 1, row))
+        return false;
+
+    id = rows.lastId;
+    return true;
+}
+
+bool MappedStorage::update(const QString& table, model_id_t id, const QVariantHash& values)
+{
+    QMutexLocker locker(&m_mutex);
+    auto rows = m_tables.find(table);
+    QVariantHash row;
+
+    if (rows == m_tables.end() || !rows->rows.contains(id) || !readRow(*rows, rows->rows.value(id), row))
+        return false;
+
+    for (auto it = values.cbegin(); it != values.cend(); ++it)
+        row.insert(it.key(), it.value());
+
+    qint64 superseded = recordSize(rows->rows.value(id));
+
+    if (!put(*rows, table, id, row))
+        return false;
+
+    m_deadBytes += superseded;
+    compactIfWasteful();
+    return true;
+}
+
+bool MappedStorage::remove(const QString& table, model_id_t id)
+{
+    QMutexLocker locker(&m_mutex);
+    auto rows = m_tables.find(table);
+    qint64 offset = -1;
+
+    if (rows == m_tables.end() || !rows->rows.contains(id))
+        return false;
+
+    qint64 superseded = recordSize(rows->rows.value(id));
+
+    if (!append(RecordType::Delete, rows->id, id, QByteArray(), offset))
+        return false;
+
+    rows->rows.remove(id);
+    m_deadBytes += superseded + recordSize(offset);
+    compactIfWasteful();
+    return true;
+}
+
+bool MappedStorage::load(const QString& table, model_id_t id, QVariantHash& row) const
+{
+    QMutexLocker locker(&m_mutex);
+    auto rows = m_tables.constFind(table);
+
+    if (rows == m_tables.constEnd() || !rows->rows.contains(id))
+        return false;
+
+    return readRow(*rows, rows->rows.value(id), row);
+}
+
+QList<model_id_t> MappedStorage::query(const QString& table, const QString& column, const QVariant& value) const
+{
+    QMutexLocker locker(&m_mutex);
+    QList<model_id_t> ids;
+    auto rows = m_tables.constFind(table);
+
+    if (rows == m_tables.constEnd())
+        return ids;
+
+    for (auto it = rows->rows.cbegin(); it != rows->rows.cend(); ++it) {
+        QVariantHash row;
+
+        if (readRow(*rows, it.value(), row) && row.value(column) == value)
+            ids << it.key();
+    }
+
+    return ids;
+}
+
+bool MappedStorage::replay()
+{
+    m_tables.clear();
+    m_lastTableId = 0;
+    m_deadBytes = 0;
+    QHash<quint64, QString> tableNames;
+    qint64 fileSize = m_file.size();
+    qint64 offset = 0;
+
+    while (offset < fileSize) {
+        qint64 size = intactRecordSize(offset);
+
+        if (size == 0) {
+            qint64 claimed = recordSize(offset);
+
+            // A damaged record whose size is still right: only that record is lost
+            if (claimed > headerSize && offset + claimed < fileSize && intactRecordSize(offset + claimed) > 0) {
+                qCritical() << "Skipping a damaged record at offset" << offset << "of" << m_fileName;
+                m_deadBytes += claimed;
+                offset += claimed;
+                continue;
+            }
+
+            // Records after a damaged one must not be dropped with it
+            for (qint64 next = offset + 1; next + headerSize < fileSize; ++next) {
+                if (intactRecordSize(next) > 0) {
+                    qCritical() << m_fileName << "is corrupted at offset" << offset;
+                    return false;
+                }
+            }
+
+            // Appends only ever tear the end of the file, left by a crash
+            qWarning() << "Discarding" << fileSize - offset << "bytes of incomplete records from" << m_fileName;
+            m_file.unmap(m_map);
+            m_map = nullptr;
+            m_mapSize = 0;
+
+            if (!m_file.resize(offset)) {
+                qCritical() << "Could not truncate storage file:" << m_file.errorString();
+                return false;
+            }
+
+            break;
+        }
+
+        RecordReader in{mapped(offset + headerSize, size - headerSize), size - headerSize, 1};
+        auto type = RecordType(in.data[0]);
+        quint64 tableId = 0;
+        quint64 id = 0;
+        in.varint(tableId);
+        in.varint(id);
+
+        if (type == RecordType::Schema) {
+            QByteArray tableName;
+            in.bytes(tableName);
+            tableNames.insert(tableId, QString::fromUtf8(tableName));
+        }
+
+        auto tableName = tableNames.constFind(tableId);
+
+        if (tableName == tableNames.constEnd()) {
+            qCritical() << "Skipping a record of unknown table" << tableId << "in" << m_fileName;
+            m_deadBytes += size;
+            offset += size;
+            continue;
+        }
+
+        Table& table = m_tables[tableName.value()];
+        table.id = tableId;
+        m_lastTableId = qMax(m_lastTableId, tableId);
+
+        if (type == RecordType::Schema) {
+            quint64 count = 0;
+            QStringList columns;
+            in.varint(count);
+
+            for (quint64 i = 0; i < count; ++i) {
+                QByteArray column;
+
+                if (!in.bytes(column))
+                    break;
+
+                columns << QString::fromUtf8(column);
+            }
+
+            if (table.schemaOffset >= 0)
+                m_deadBytes += recordSize(table.schemaOffset);
+
+            table.columns = columns;
+            table.schemaOffset = offset;
+            table.lastId = qMax(table.lastId, id);
+        } else if (type == RecordType::Put) {
+            if (table.rows.contains(id))
+                m_deadBytes += recordSize(table.rows.value(id));
+
+            table.rows.insert(id, offset);
+            table.lastId = qMax(table.lastId, id);
+        } else {
+            if (table.rows.contains(id))
+                m_deadBytes += recordSize(table.rows.value(id));
+
+            table.rows.remove(id);
+            table.lastId = qMax(table.lastId, id); // Ids are never reused
+            m_deadBytes += size;
+        }
+
+        offset += size;
+    }
+
+    return m_file.seek(m_file.size());
+}
+
+bool MappedStorage::append(RecordType type, quint64 tableId, model_id_t id, const QByteArray& payload, qint64& offset)
+{
+    QByteArray record = encodeRecord(type, tableId, id, payload);
+    offset = m_file.size();
+
+    if (!m_file.seek(offset) || m_file.write(record) != record.size() || !m_file.flush()) {
+        qCritical() << "Could not append to storage file:" << m_file.errorString();
+        // Leave the file as it was, a partial record would hide the next ones
+        m_file.resize(offset);
+        return false;
+    }
+
+#ifdef Q_OS_UNIX
+    if (m_syncWrites && ::fsync(m_file.handle()) != 0) {
+        qCritical() << "Could not sync storage file";
+        // The caller doesn't index the record, so it mustn't be replayed either
+        m_file.resize(offset);
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+bool MappedStorage::put(Table& table, const QString& tableName, model_id_t id, const QVariantHash& row)
+{
+    qint64 offset = -1;
+    QStringList columns = table.columns;
+
+    for (auto it = row.cbegin(); it != row.cend(); ++it) {
+        if (!columns.contains(it.key()))
+            columns << it.key();
+    }
+
+    // Columns are only ever appended, so older records remain readable
+    if (columns.size() != table.columns.size() || table.schemaOffset < 0) {
+        quint64 tableId = table.schemaOffset < 0 ? m_lastTableId + 1 : table.id;
+
+        if (!append(RecordType::Schema, tableId, table.lastId, schemaPayload(tableName, columns), offset))
+            return false;
+
+        if (table.schemaOffset >= 0)
+            m_deadBytes += recordSize(table.schemaOffset);
+
+        table.id = tableId;
+        m_lastTableId = qMax(m_lastTableId, tableId);
+        table.columns = columns;
+        table.schemaOffset = offset;
+    }
+
+    QByteArray values;
+    Encoding::putVarint(values, quint64(columns.size()));
+
+    for (const QString& column : std::as_const(columns))
+        putValue(values, row.value(column));
+
+    if (!append(RecordType::Put, table.id, id, values, offset))
+        return false;
+
+    table.rows.insert(id, offset);
+    table.lastId = qMax(table.lastId, id);
+    return true;
+}
+
+bool MappedStorage::readRow(const Table& table, qint64 offset, QVariantHash& row) const
+{
+    qint64 size = recordSize(offset);
+    const uchar* record = mapped(offset, size);
+
+    if (record == nullptr)
+        return false;
+
+    // Skips the type, the table id and the row id
+    RecordReader in{record + headerSize, size - headerSize, 1};
+    quint64 skipped = 0;
+    quint64 count = 0;
+
+    if (!in.varint(skipped) || !in.varint(skipped) || !in.varint(count))
+        return false;
+
+    row.clear();
+    row.reserve(qMin(qsizetype(count), table.columns.size()));
+
+    for (quint64 i = 0; i < count; ++i) {
+        QVariant value;
+
+        if (!in.readValue(value))
+            return false;
+
+        if (qsizetype(i) < table.columns.size())
+            row.insert(table.columns.at(i), value);
+    }
+
+    return true;
+}
+
+qint64 MappedStorage::recordSize(qint64 offset) const
+{
+    const uchar* header = mapped(offset, headerSize);
+    return header ? headerSize + qFromLittleEndian<quint32>(header) : 0;
+}
+
+const uchar* MappedStorage::mapped(qint64 offset, qint64 size) const
+{
+    if (offset + size > m_mapSize) {
+        // The file grew since it was mapped
+        if (m_map != nullptr)
+            m_file.unmap(m_map);
+
+        m_mapSize = m_file.size();
+        m_map = m_mapSize > 0 ? m_file.map(0, m_mapSize) : nullptr;
+
+        if (m_map == nullptr)
+            m_mapSize = 0;
+    }
+
+    return offset + size <= m_mapSize ? m_map + offset : nullptr;
+}
+
+qint64 MappedStorage::intactRecordSize(qint64 offset) const
+{
+    const uchar* header = mapped(offset, headerSize);
+    qint64 bodySize = header ? qFromLittleEndian<quint32>(header) : 0;
+    const uchar* body = bodySize > 0 ? mapped(offset + headerSize, bodySize) : nullptr;
+
+    if (body == nullptr || qFromLittleEndian<quint32>(header + sizeof(quint32)) != checksum(body, bodySize))
+        return 0;
+
+    if (body[0] < quint8(RecordType::Schema) || body[0] > quint8(RecordType::Delete))
+        return 0;
+
+    return headerSize + bodySize;
+}
+
+QByteArray MappedStorage::encodeRecord(RecordType type, quint64 tableId, model_id_t id, const QByteArray& payload)
+{
+    QByteArray body;
+    body.reserve(1 + 2 * 10 + payload.size());
+    body.append(char(type));
+    Encoding::putVarint(body, tableId);
+    Encoding::putVarint(body, id);
+    body.append(payload);
+
+    QByteArray record(headerSize, Qt::Uninitialized);
+    qToLittleEndian<quint32>(quint32(body.size()), record.data());
+    qToLittleEndian<quint32>(checksum(body.constData(), body.size()), record.data() + sizeof(quint32));
+    return record + body;
+}
+
+bool MappedStorage::compactFile()
+{
+    QSaveFile compacted(m_fileName);
+
+    if (!compacted.open(QIODevice::WriteOnly)) {
+        qCritical() << "Could not create compacted storage file:" << compacted.errorString();
+        return false;
+    }
+
+    for (auto table = m_tables.cbegin(); table != m_tables.cend(); ++table) {
+        if (table->schemaOffset < 0)
+            continue; // Nothing was ever written to it
+
+        // A fresh schema record keeps the last id, so the ids of deleted rows aren't reused
+        QByteArray schema = encodeRecord(RecordType::Schema, table->id, table->lastId, schemaPayload(table.key(), table->columns));
+        bool written = compacted.write(schema) == schema.size();
+
+        // The live rows are copied verbatim
+        for (auto it = table->rows.cbegin(); written && it != table->rows.cend(); ++it) {
+            qint64 size = recordSize(it.value());
+            const uchar* record = mapped(it.value(), size);
+            written = record != nullptr && compacted.write(reinterpret_cast<const char*>(record), size) == size;
+        }
+
+        if (!written) {
+            qCritical() << "Could not write compacted storage file:" << compacted.errorString();
+            compacted.cancelWriting();
+            return false;
+        }
+    }
+
+    close();
+    bool committed = compacted.commit();
+
+    // The old file is left untouched when it couldn't be replaced, so it's reopened
+    if (!committed)
+        qCritical() << "Could not replace storage file:" << compacted.errorString();
+
+    m_file.setFileName(m_fileName);
+
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        qCritical() << "Could not open storage file:" << m_file.errorString();
+        return false;
+    }
+
+    return replay() && committed;
+}
+
+void MappedStorage::compactIfWasteful()
+{
+    if (m_file.size() >= compactionThreshold && m_deadBytes * 2 > m_file.size())
+        compactFile();
+}
+
+void MappedStorage::close()
+{
+    if (m_map != nullptr)
+        m_file.unmap(m_map);
+
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_tables.clear();
+    m_file.close();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <QMap>
+#include <QFile>
+#include <QMutex>
+#include "ModelStorage.hpp"
+
+/**
+ * @brief Stores the rows as compact binary records in a single append-only file,
+ *        read through a memory mapping, without any SQL. Meant for devices that
+ *        persist many simple Models and need low latency point loads and inserts.
+ *
+ *        Every insert, update and delete appends a checksummed record to the file and
+ *        the ordered id index of each table is rebuilt by replaying the file on open.
+ *        Records reference their table by a small id declared by its schema record,
+ *        and store integers as varints. A record that was only partially written by a
+ *        crash fails its checksum and is truncated away on the next open. A damaged
+ *        record followed by intact ones is skipped when its size is readable, and
+ *        otherwise the file isn't opened. Superseded records are reclaimed by compact,
+ *        which is also run automatically once they take most of the file.
+ */
+class QTMODELLIBRARY_EXPORT MappedStorage : public ModelStorage
+{
+public:
+    /**
+     * @param fileName The path of the storage file, created if it doesn't exist.
+     * @param syncWrites Should every write be flushed to the disk (fsync) before
+     *        returning. Disabling it is faster but the last writes may be lost
+     *        (never corrupted) on a power failure.
+     */
+    explicit MappedStorage(const QString& fileName, bool syncWrites = true);
+    ~MappedStorage() override;
+
+    /**
+     * @brief Opens the storage file and rebuilds the index.
+     * @return true if the file could be opened, false otherwise.
+     */
+    bool open();
+
+    /**
+     * @brief Rewrites the file keeping only the live records. The new file atomically
+     *        replaces the old one.
+     * @return true if the file was compacted, false otherwise.
+     */
+    bool compact();
+
+    bool insert(const QString& table, const QVariantHash& row, model_id_t& id) override;
+    bool update(const QString& table, model_id_t id, const QVariantHash& values) override;
+    bool remove(const QString& table, model_id_t id) override;
+    bool load(const QString& table, model_id_t id, QVariantHash& row) const override;
+    QList<model_id_t> query(const QString& table, const QString& column, const QVariant& value) const override;
+
+private:
+    Q_DISABLE_COPY(MappedStorage)
+
+    enum class RecordType : quint8 { Schema = 1, Put = 2, Delete = 3 };
+
+    struct Table {
+        quint64 id = 0; ///< References the table in the records
+        QStringList columns;
+        // The highest id ever used, also stored in the schema records
+        model_id_t lastId = 0;
+        qint64 schemaOffset = -1;
+        // Offset of the latest record of each row, ordered by id
+        QMap<model_id_t, qint64> rows;
+    };
+
+    QString m_fileName;
+    bool m_syncWrites;
+    mutable QMutex m_mutex;
+    mutable QFile m_file;
+    mutable uchar* m_map{nullptr};
+    mutable qint64 m_mapSize{0};
+    qint64 m_deadBytes{0};
+    quint64 m_lastTableId{0};
+    QHash<QString, Table> m_tables;
+
+    static QByteArray encodeRecord(RecordType type, quint64 tableId, model_id_t id, const QByteArray& payload);
+
+    bool replay();
+    bool compactFile();
+    bool append(RecordType type, quint64 tableId, model_id_t id, const QByteArray& payload, qint64& offset);
+    bool put(Table& table, const QString& tableName, model_id_t id, const QVariantHash& row);
+    bool readRow(const Table& table, qint64 offset, QVariantHash& row) const;
+    qint64 recordSize(qint64 offset) const;
+
+    /**
+     * @brief The size of the record at the given offset if it's complete and its
+     *        checksum matches, 0 otherwise.
+     */
+    qint64 intactRecordSize(qint64 offset) const;
+    const uchar* mapped(qint64 offset, qint64 size) const;
+    void compactIfWasteful();
+    void close();
+};
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include "MemoryStorage.hpp"
+
+bool MemoryStorage::insert(const QString& table, const QVariantHash& row, model_id_t& id)
+{
+    QWriteLocker locker(&m_lock);
+    Table& rows = m_tables[table];
+    id = ++rows.lastId;
+    rows.rows.insert(id, row);
+    updateIndexes(rows, id, row, true);
+    return true;
+}
+
+bool MemoryStorage::update(const QString& table, model_id_t id, const QVariantHash& values)
+{
+    QWriteLocker locker(&m_lock);
+    auto rows = m_tables.find(table);
+
+    if (rows == m_tables.end() || !rows->rows.contains(id))
+        return false;
+
+    QVariantHash& row = rows->rows[id];
+    updateIndexes(*rows, id, row, false);
+
+    for (auto it = values.cbegin(); it != values.cend(); ++it)
+        row.insert(it.key(), it.value());
+
+    updateIndexes(*rows, id, row, true);
+    return true;
+}
+
+bool MemoryStorage::remove(const QString& table, model_id_t id)
+{
+    QWriteLocker locker(&m_lock);
+    auto rows = m_tables.find(table);
+
+    if (rows == m_tables.end() || !rows->rows.contains(id))
+        return false;
+
+    updateIndexes(*rows, id, rows->rows.value(id), false);
+    rows->rows.remove(id);
+    return true;
+}
+
+bool MemoryStorage::load(const QString& table, model_id_t id, QVariantHash& row) const
+{
+    QReadLocker locker(&m_lock);
+    auto rows = m_tables.constFind(table);
+
+    if (rows == m_tables.constEnd())
+        return false;
+
+    auto found = rows->rows.constFind(id);
+
+    if (found == rows->rows.constEnd())
+        return false;
+
+    row = found.value();
+    return true;
+}
+
+QList<model_id_t> MemoryStorage::query(const QString& table, const QString& column, const QVariant& value) const
+{
+    QReadLocker locker(&m_lock);
+    QList<model_id_t> ids;
+    auto rows = m_tables.constFind(table);
+
+    if (rows == m_tables.constEnd())
+        return ids;
+
+    auto index = rows->indexes.constFind(column);
+
+    if (index != rows->indexes.constEnd()) {
+        // Different values may share a key, e.g. 1 and "1", so compare the rows too
+        for (model_id_t id : index->values(indexKey(value))) {
+            if (rows->rows.value(id).value(column) == value)
+                ids << id;
+        }
+    } else {
+        for (auto row = rows->rows.cbegin(); row != rows->rows.cend(); ++row) {
+            if (row->value(column) == value)
+                ids << row.key();
+        }
+    }
+
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+void MemoryStorage::createIndex(const QString& table, const QString& column)
+{
+    QWriteLocker locker(&m_lock);
+    Table& rows = m_tables[table];
+
+    if (rows.indexes.contains(column))
+        return;
+
+    QMultiHash<QString, model_id_t>& index = rows.indexes[column];
+
+    for (auto row = rows.rows.cbegin(); row != rows.rows.cend(); ++row)
+        index.insert(indexKey(row->value(column)), row.key());
+}
+
+MemoryStorage* MemoryStorage::snapshot() const
+{
+    auto snapshot = new MemoryStorage;
+    QReadLocker locker(&m_lock);
+    snapshot->m_tables = m_tables; // Implicitly shared until either side writes
+    return snapshot;
+}
+
+QString MemoryStorage::indexKey(const QVariant& value)
+{
+    return value.isNull() ? QString() : value.toString();
+}
+
+void MemoryStorage::updateIndexes(Table& table, model_id_t id, const QVariantHash& row, bool add)
+{
+    for (auto index = table.indexes.begin(); index != table.indexes.end(); ++index) {
+        QString key = indexKey(row.value(index.key()));
+
+        if (add)
+            index->insert(key, id);
+        else
+            index->remove(key, id);
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QHash>
+#include <QReadWriteLock>
+#include "ModelStorage.hpp"
+
+/**
+ * @brief Keeps the rows in memory, in a hash table per table, without any SQL.
+ *        Meant for tests and latency sensitive caches.
+ *
+ *        Equality queries can be sped up with secondary indexes. The tables are
+ *        implicitly shared, so snapshot returns a consistent copy of the whole storage
+ *        in constant time, which is only detached (copy-on-write) by later writes.
+ */
+class QTMODELLIBRARY_EXPORT MemoryStorage : public ModelStorage
+{
+public:
+    MemoryStorage() = default;
+
+    bool insert(const QString& table, const QVariantHash& row, model_id_t& id) override;
+    bool update(const QString& table, model_id_t id, const QVariantHash& values) override;
+    bool remove(const QString& table, model_id_t id) override;
+    bool load(const QString& table, model_id_t id, QVariantHash& row) const override;
+    QList<model_id_t> query(const QString& table, const QString& column, const QVariant& value) const override;
+
+    /**
+     * @brief Maintains a secondary index on a column, used by query.
+     */
+    void createIndex(const QString& table, const QString& column);
+
+    /**
+     * @brief Copies the current state of the storage. Reads of the snapshot aren't
+     *        affected by later writes to this storage and vice-versa.
+     * @return A new storage owned by the caller.
+     */
+    MemoryStorage* snapshot() const;
+
+private:
+    Q_DISABLE_COPY(MemoryStorage)
+
+    struct Table {
+        model_id_t lastId = 0;
+        QHash<model_id_t, QVariantHash> rows;
+        // column -> value key -> ids of the rows with that value
+        QHash<QString, QMultiHash<QString, model_id_t>> indexes;
+    };
+
+    mutable QReadWriteLock m_lock;
+    QHash<QString, Table> m_tables;
+
+    static QString indexKey(const QVariant& value);
+    static void updateIndexes(Table& table, model_id_t id, const QVariantHash& row, bool add);
+};
@@ -1,239 +1,2094 @@
+#include <map>
+#include <memory>
+#include <utility>
+#include <QMutex>
+#include <QMetaEnum>
+#include <QLoggingCategory>
+#include <QRegularExpression>
 #include <QSqlQuery>
 #include <QSqlError>
+#include <QSqlDriver>
+#include <QSqlDatabase>
 #include "Model.hpp"
+#include "QueryCache.hpp"
+#include "SharedRowCache.hpp"
+#include "SqliteMaintenance.hpp"
+#include "ModelStorage.hpp"
+
+#ifdef QTMODELLIBRARY_NATIVE_SQLITE
+#include "SqliteBackend.hpp"
+#endif
+
+#ifdef QTMODELLIBRARY_NATIVE_POSTGRES
+#include "PostgresBackend.hpp"
+#endif
+
+namespace {
+
+// The fetch strategy changes, enabled with QT_LOGGING_RULES="qtmodellibrary.fetch.debug=true"
+Q_LOGGING_CATEGORY(fetchPlanning, "qtmodellibrary.fetch", QtInfoMsg)
+
+/**
+ * @brief Runtime statistics of the related Model properties, used to plan how
+ *        each relation is fetched.
+ */
+class RelationStatistics
+{
+public:
+    Model::FetchStrategy plan(const char* className, const QString& relation, int rowWidth, double roundTripCost)
+    {
+        QMutexLocker locker(&m_mutex);
+        Entry& entry = m_entries[QString("%1.%2").arg(className, relation)];
+        // The fraction of rows that actually reference a related Model
+        double linkedFraction = entry.rows > 0 ? double(entry.linked) / entry.rows : 1.0;
+        // The fraction of the relations left lazy that were loaded afterwards
+        double hitRate = entry.lazy > 0 ? double(entry.resolved) / entry.lazy : 1.0;
+        Model::FetchStrategy strategy;
+
+        // Lazy relations keep being sampled, so the relation is fetched again once it's used
+        if (entry.lazy >= minLazySample && hitRate < maxLazyHitRate)
+            strategy = Model::FetchStrategy::Lazy;
+        // Joining always widens the row, selecting only costs a round trip when linked
+        else if (rowWidth <= linkedFraction * roundTripCost)
+            strategy = Model::FetchStrategy::Join;
+        else
+            strategy = Model::FetchStrategy::Select;
+
+        if (!entry.planned || entry.strategy != strategy) {
+            qCDebug(fetchPlanning).noquote() << QString("Fetching %1.%2 with %3 (row width %4, linked %5, lazy hit rate %6)")
+                                                    .arg(className, relation,
+                                                         QMetaEnum::fromType<Model::FetchStrategy>().valueToKey(int(strategy)))
+                                                    .arg(rowWidth)
+                                                    .arg(linkedFraction, 0, 'f', 2)
+                                                    .arg(hitRate, 0, 'f', 2);
+            entry.planned = true;
+            entry.strategy = strategy;
+        }
+
+        return strategy;
+    }
+
+    void record(const char* className, const QString& relation, bool linked, Model::FetchStrategy strategy)
+    {
+        QMutexLocker locker(&m_mutex);
+        Entry& entry = m_entries[QString("%1.%2").arg(className, relation)];
+        entry.rows++;
+
+        if (linked)
+            entry.linked++;
+
+        if (linked && strategy == Model::FetchStrategy::Lazy)
+            entry.lazy++;
+    }
+
+    void resolved(const char* className, const QString& relation)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_entries[QString("%1.%2").arg(className, relation)].resolved++;
+    }
+
+private:
+    // A relation is left lazy once this many lazy rows loaded less than this fraction
+    static constexpr quint64 minLazySample = 100;
+    static constexpr double maxLazyHitRate = 0.1;
+
+    struct Entry {
+        quint64 rows = 0;
+        quint64 linked = 0;
+        quint64 lazy = 0;
+        quint64 resolved = 0;
+        bool planned = false;
+        Model::FetchStrategy strategy = Model::FetchStrategy::Select;
+    };
+
+    QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+};
+
+RelationStatistics& relationStatistics()
+{
+    static RelationStatistics statistics;
+    return statistics;
+}
+
+/**
+ * @brief Runs a group of queries in a single transaction on the default connection.
+ *        Read transactions make a graph load see a single commit, and SQLite takes
+ *        its shared lock only once; PostgreSQL uses a REPEATABLE READ snapshot. They
+ *        are committed when the scope ends. Write transactions must be committed,
+ *        otherwise they are rolled back when the scope ends.
+ *        Nested scopes join the outermost transaction, and scopes inside a
+ *        transaction started by the application use that transaction instead.
+ *        Work that must only be seen once the data is committed, like filling or
+ *        invalidating caches, is deferred with afterCommit.
+ */
+class ScopedTransaction
+{
+public:
+    enum Mode { Read, Write };
+
+    ScopedTransaction(Mode mode, bool needed)
+        : m_mode{mode}
+    {
+        if (!needed)
+            return;
+
+        // Only scopes within a transaction of this class are counted, so a scope that
+        // isn't needed never keeps a nested one from starting its transaction
+        if (depth > 0) {
+            m_counted = true;
+            ++depth;
+            return;
+        }
+
+        // An enclosing scope already found the application's transaction
+        if (joined > 0) {
+            m_joined = true;
+            ++joined;
+            return;
+        }
+
+        QSqlDatabase database = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+
+        if (!database.isOpen() || !database.driver()->hasFeature(QSqlDriver::Transactions))
+            return;
+
+        m_database = database;
+
+        if (database.driverName() != "QPSQL")
+            m_active = database.transaction(); // Fails if a transaction is in progress
+        else if (applicationTransaction(database))
+            m_joined = true;
+        else
+            m_active = QSqlQuery(database).exec(mode == Read ? "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY" : "BEGIN");
+
+        m_counted = m_active;
+
+        if (m_counted)
+            ++depth;
+
+        if (m_joined)
+            ++joined;
+    }
+
+    ~ScopedTransaction()
+    {
+        if (m_counted)
+            --depth;
+
+        if (m_joined)
+            --joined;
+
+        if (m_active && m_mode == Read) {
+            commit();
+        } else if (m_active) {
+            m_active = false;
+            committedActions.clear();
+
+            if (!m_database.rollback())
+                qWarning() << "Could not roll back the transaction:" << m_database.lastError().text();
+
+            runEndActions();
+        }
+    }
+
+    bool commit()
+    {
+        if (!m_active)
+            return true;
+
+        m_active = false;
+        QList<std::function<void ()>> actions = std::exchange(committedActions, {});
+
+        if (!m_database.commit()) {
+            qWarning() << "Could not commit the transaction:" << m_database.lastError().text();
+            runEndActions();
+            return false;
+        }
+
+        for (const auto& action : std::as_const(actions))
+            action();
+
+        runEndActions();
+        return true;
+    }
+
+    /**
+     * @brief Checks whether a transaction is in progress on the default connection,
+     *        either of this class or of the application. Transactions the application
+     *        opens on SQLite are only seen by the native SQLite backend.
+     */
+    static bool inProgress()
+    {
+        // The scopes in progress already know, which saves a round trip on QPSQL
+        if (depth > 0 || joined > 0)
+            return true;
+
+        QSqlDatabase database = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+
+        if (database.isOpen() && applicationTransaction(database))
+            return true;
+
+        // The application's transaction that deferred them has ended
+        runEndActions();
+        return false;
+    }
+
+    /**
+     * @brief Runs the action once the outermost transaction of this class commits,
+     *        or right away outside of transactions. The actions of a transaction that
+     *        is rolled back are dropped.
+     * @return false if the action wasn't run because the application has a
+     *         transaction in progress, whose end can't be observed.
+     */
+    static bool afterCommit(std::function<void ()> action)
+    {
+        if (depth > 0) {
+            committedActions.append(std::move(action));
+            return true;
+        }
+
+        if (inProgress())
+            return false;
+
+        action();
+        return true;
+    }
+
+    /**
+     * @brief Runs the action once the transaction in progress ends, whether it's
+     *        committed or rolled back, or right away outside of transactions. The end
+     *        of the application's transactions is only noticed the next time this
+     *        class checks whether a transaction is in progress.
+     */
+    static void afterEnd(std::function<void ()> action)
+    {
+        if (depth > 0 || inProgress())
+            endActions.append(std::move(action));
+        else
+            action();
+    }
+
+private:
+    /**
+     * @brief Checks whether the application has a transaction in progress, which the
+     *        native backends read from the connection state. Plain QPSQL connections
+     *        are asked with a query; other drivers can't tell.
+     */
+    static bool applicationTransaction(const QSqlDatabase& database)
+    {
+#ifdef QTMODELLIBRARY_NATIVE_SQLITE
+        if (SqliteBackend::isAvailable())
+            return SqliteBackend::inTransaction();
+#endif
+#ifdef QTMODELLIBRARY_NATIVE_POSTGRES
+        if (PostgresBackend::isAvailable())
+            return PostgresBackend::inTransaction();
+#endif
+        if (database.driverName() != "QPSQL")
+            return false;
+
+        // now() is the start time of the current transaction, which only matches the
+        // start time of this statement when no transaction is in progress
+        QSqlQuery query(database);
+        return !query.exec("SELECT now() = statement_timestamp()") || !query.next() || !query.value(0).toBool();
+    }
+
+    static thread_local int depth;
+    // Scopes using a transaction of the application
+    static thread_local int joined;
+    static thread_local QList<std::function<void ()>> committedActions;
+    static thread_local QList<std::function<void ()>> endActions;
+
+    static void runEndActions()
+    {
+        for (const auto& action : std::exchange(endActions, {}))
+            action();
+    }
+    Mode m_mode;
+    QSqlDatabase m_database;
+    bool m_active = false;
+    bool m_counted = false;
+    bool m_joined = false;
+};
+
+thread_local int ScopedTransaction::depth = 0;
+thread_local int ScopedTransaction::joined = 0;
+thread_local QList<std::function<void ()>> ScopedTransaction::committedActions;
+thread_local QList<std::function<void ()>> ScopedTransaction::endActions;
+
+struct Codec {
+    quint8 header;
+    std::function<QByteArray (const QByteArray&)> compress;
+    std::function<QByteArray (const QByteArray&)> decompress;
+};
+
+/**
+ * @brief The registered compression codecs, by name and by header byte.
+ */
+class Codecs
+{
+public:
+    Codecs()
+    {
+        add("zlib", {1, [](const QByteArray& value) { return qCompress(value); },
+                     [](const QByteArray& value) { return qUncompress(value); }});
+    }
+
+    void add(const QString& name, const Codec& codec)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_byName.insert(name, codec);
+        m_byHeader.insert(codec.header, codec);
+    }
+
+    bool byName(const QString& name, Codec& codec)
+    {
+        QMutexLocker locker(&m_mutex);
+        codec = m_byName.value(name);
+        return m_byName.contains(name);
+    }
+
+    bool byHeader(quint8 header, Codec& codec)
+    {
+        QMutexLocker locker(&m_mutex);
+        codec = m_byHeader.value(header);
+        return m_byHeader.contains(header);
+    }
+
+private:
+    QMutex m_mutex;
+    QHash<QString, Codec> m_byName;
+    QHash<quint8, Codec> m_byHeader;
+};
+
+Codecs& codecs()
+{
+    static Codecs codecs;
+    return codecs;
+}
+
+// Compressing smaller values wouldn't pay off the header and the CPU time
+constexpr int defaultCompressionThreshold = 512;
+
+/**
+ * @brief The in-process copies of the side tables of the dictionary encoded
+ *        properties, mapping each distinct value to its integer code and back.
+ *        Loaded values are the QStrings kept here, so every instance holding the
+ *        same value shares a single string buffer.
+ */
+class Dictionaries
+{
+public:
+    QVariant code(const QString& table, const QString& value)
+    {
+        QMutexLocker locker(&m_mutex);
+        Dictionary& dictionary = m_dictionaries[table];
+        auto cached = dictionary.codes.constFind(value);
+
+        if (cached != dictionary.codes.constEnd())
+            return cached.value();
+
+        if (!create(table, dictionary))
+            return QVariant();
+
+        QSqlQuery query;
+        QString driverName = QSqlDatabase::database().driverName();
+        bool returning = driverName == "QPSQL";
+        QString insertQuery = "INSERT INTO %1 (value) VALUES (:value)";
+
+        // A value added concurrently is skipped rather than failing, PostgreSQL would
+        // even abort the transaction, and read by the next SELECT
+        if (driverName == "QPSQL")
+            insertQuery = "INSERT INTO %1 (value) VALUES (:value) ON CONFLICT (value) DO NOTHING RETURNING code";
+        else if (driverName == "QSQLITE")
+            insertQuery = "INSERT OR IGNORE INTO %1 (value) VALUES (:value)";
+
+        // A concurrent writer may add the same value between the SELECT and the INSERT
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            query.prepare(QString("SELECT code FROM %1 WHERE value = :value").arg(table));
+            query.bindValue(":value", value);
+
+            if (query.exec() && query.first()) {
+                qlonglong code = query.value(0).toLongLong();
+                locker.unlock();
+                remember(table, code, value);
+                return code;
+            }
+
+            query.prepare(insertQuery.arg(table));
+            query.bindValue(":value", value);
+
+            if (!query.exec())
+                break;
+
+            QVariant code;
+
+            // An ignored INSERT leaves the last insert id of an earlier statement
+            if (returning)
+                code = query.first() ? query.value(0) : QVariant();
+            else if (query.numRowsAffected() > 0)
+                code = query.lastInsertId();
+
+            if (code.isValid()) {
+                locker.unlock();
+                remember(table, code.toLongLong(), value);
+                return code.toLongLong();
+            }
+        }
+
+        qCritical() << "Could not add a value to the dictionary" << table << ":" << query.lastError().text();
+        return QVariant();
+    }
+
+    QVariant value(const QString& table, qlonglong code)
+    {
+        QMutexLocker locker(&m_mutex);
+        Dictionary& dictionary = m_dictionaries[table];
+        auto cached = dictionary.values.constFind(code);
+
+        if (cached != dictionary.values.constEnd())
+            return cached.value();
+
+        locker.unlock();
+        QSqlQuery query;
+        query.prepare(QString("SELECT value FROM %1 WHERE code = :code").arg(table));
+        query.bindValue(":code", code);
+
+        if (!query.exec() || !query.first()) {
+            qCritical() << "Unknown code" << code << "in the dictionary" << table;
+            return QVariant();
+        }
+
+        remember(table, code, query.value(0).toString());
+        return query.value(0).toString();
+    }
+
+private:
+    struct Dictionary {
+        bool created = false;
+        QHash<QString, qlonglong> codes;
+        QHash<qlonglong, QString> values;
+    };
+
+    QMutex m_mutex;
+    QHash<QString, Dictionary> m_dictionaries;
+
+    /**
+     * @brief Caches a code once it's committed. A code added by a transaction that is
+     *        rolled back doesn't exist, so inside the application's transactions codes
+     *        are looked up every time. Transactions the application opens on SQLite are
+     *        only seen by the native backend, which is why codes are never reused:
+     *        a cached code that was rolled back can't stand for another value.
+     */
+    void remember(const QString& table, qlonglong code, const QString& value)
+    {
+        ScopedTransaction::afterCommit([this, table, code, value]() {
+            QMutexLocker locker(&m_mutex);
+            Dictionary& dictionary = m_dictionaries[table];
+            dictionary.codes.insert(value, code);
+            dictionary.values.insert(code, value);
+        });
+    }
+
+    static bool create(const QString& table, Dictionary& dictionary)
+    {
+        if (dictionary.created)
+            return true;
+
+        QSqlQuery query;
+        QString code = QSqlDatabase::database().driverName() == "QPSQL" ? "code BIGINT GENERATED BY DEFAULT AS IDENTITY PRIMARY KEY"
+                                                                        : "code INTEGER PRIMARY KEY AUTOINCREMENT";
+
+        if (!query.exec(QString("CREATE TABLE IF NOT EXISTS %1 (%2, value TEXT NOT NULL UNIQUE)").arg(table, code))) {
+            qCritical() << "Could not create the dictionary" << table << ":" << query.lastError().text();
+            return false;
+        }
+
+        // The table may still be rolled back, then it's created again
+        dictionary.created = !ScopedTransaction::inProgress();
+        return true;
+    }
+};
+
+Dictionaries& dictionaries()
+{
+    static Dictionaries dictionaries;
+    return dictionaries;
+}
+
+/**
+ * @brief Pools of the distinct values of the interned QString properties, so equal
+ *        loaded values share one implicitly shared buffer instead of each holding
+ *        the copy allocated by the driver.
+ */
+class InternPools
+{
+public:
+    QString intern(const QString& table, const char* property, const QString& value, bool automatic)
+    {
+        QMutexLocker locker(&m_mutex);
+        Pool& pool = m_pools[QString("%1.%2").arg(table, property)];
+
+        if (pool.disabled)
+            return value;
+
+        auto interned = pool.values.constFind(value);
+        bool found = interned != pool.values.constEnd();
+
+        if (!found)
+            interned = pool.values.insert(value);
+
+        // Mostly distinct values would only grow the pool without being shared. The
+        // decision is taken on the last sampled value, whether it was found or not
+        if (automatic && pool.sampled < sampleSize && ++pool.sampled == sampleSize
+            && pool.values.size() > sampleSize * maxDistinctRatio) {
+            qInfo() << "Not interning" << table << property << "which has too many distinct values";
+            pool.disabled = true;
+            pool.values.clear();
+            return value;
+        }
+
+        if (found)
+            m_savedBytes[table] += value.size() * qint64(sizeof(QChar)) + stringOverhead;
+
+        return *interned;
+    }
+
+    QHash<QString, qint64> savedBytes()
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_savedBytes;
+    }
+
+private:
+    struct Pool {
+        QSet<QString> values;
+        int sampled = 0;
+        bool disabled = false;
+    };
+
+    // The automatic interning decision is taken over the first sampleSize values
+    static constexpr int sampleSize = 1024;
+    static constexpr double maxDistinctRatio = 0.5;
+    // The allocation header of a QString buffer
+    static constexpr qint64 stringOverhead = 2 * sizeof(void*);
+
+    QMutex m_mutex;
+    QHash<QString, Pool> m_pools;
+    QHash<QString, qint64> m_savedBytes;
+};
+
+InternPools& internPools()
+{
+    static InternPools pools;
+    return pools;
+}
+
+}
 
 Model::Model(QObject* parent)
     : QObject{parent}
 {
 }
 
-model_id_t Model::id() const
-{
-    return m_id;
-}
+model_id_t Model::id() const
+{
+    return m_id;
+}
+
+bool Model::isSaved() const
+{
+    return m_id != 0;
+}
+
+bool Model::isModified() const
+{
+    return !m_modifiedProperties.isEmpty();
+}
+
+bool Model::insert()
+{
+    if (isSaved())
+        return false;
+
+    if (ModelStorage* storage = ModelStorage::storage(metaObject())) {
+        QVariantHash row;
+        model_id_t insertedId = 0;
+
+        forEachProperty([&row, this](auto metaProperty) {
+            row.insert(metaProperty.name(), databaseValue(metaProperty));
+        });
+
+        if (!storage->insert(tableName(), row, insertedId))
+            return false;
+
+        setId(insertedId);
+        return true;
+    }
+
+    QList<CounterCache> caches = counterCaches();
+    ScopedTransaction transaction(ScopedTransaction::Write, !caches.isEmpty());
+
+    if (!execDML(insertQuery()))
+        return false;
+
+    if (caches.isEmpty())
+        return true;
+
+    return applyCounterCaches(caches, QVariantHash(), storedValues(caches)) && transaction.commit();
+}
+
+bool Model::update()
+{
+    if (!isSaved()) {
+        qWarning() << "Model is not saved";
+        return false;
+    }
+
+    if (!isModified())
+        return false;
+
+    if (ModelStorage* storage = ModelStorage::storage(metaObject())) {
+        QVariantHash values;
+
+        for (const QString& propertyName : modifiedProperties()) {
+            QMetaProperty metaProperty = metaObject()->property(metaObject()->indexOfProperty(propertyName.toLocal8Bit()));
+            Model* related = isPropertyModel(metaProperty) ? metaProperty.read(this).value<Model*>() : nullptr;
+
+            if (related != nullptr && !related->isSaved() && !related->insert())
+                return false;
+            else if (related != nullptr && related->isModified() && !related->update())
+                return false;
+
+            values.insert(propertyName, databaseValue(metaProperty));
+        }
+
+        return storage->update(tableName(), id(), values);
+    }
+
+    QList<CounterCache> caches = modifiedCounterCaches();
+    ScopedTransaction transaction(ScopedTransaction::Write, !caches.isEmpty());
+    QVariantHash before = caches.isEmpty() ? QVariantHash() : storedValues(caches);
+
+    if (!execDML(updateQuery()))
+        return false;
+
+    if (caches.isEmpty())
+        return true;
+
+    return applyCounterCaches(caches, before, storedValues(caches)) && transaction.commit();
+}
+
+bool Model::merge(model_id_t id, const QVariant& version)
+{
+    if (id == 0) {
+        qWarning() << "Can't merge a Model without an id";
+        return false;
+    }
+
+    if (!isModified())
+        return false;
+
+    setId(id);
+
+    // Storages don't keep versions
+    if (ModelStorage::storage(metaObject()) != nullptr)
+        return update();
+
+    QList<CounterCache> caches = modifiedCounterCaches();
+    ScopedTransaction transaction(ScopedTransaction::Write, !caches.isEmpty());
+    QVariantHash before = caches.isEmpty() ? QVariantHash() : storedValues(caches);
+    QVariant variant = versionedUpdateQuery(version);
+
+    if (!variant.isValid())
+        return false;
+
+    QSqlQuery query = variant.value<QSqlQuery>();
+
+    if (!query.exec()) {
+        qCritical() << "Could not execute merge UPDATE query:" << query.lastError().text();
+        return false;
+    }
+
+    if (query.numRowsAffected() == 0) {
+        qWarning().noquote() << QString("%1 %2 was deleted or changed since it was read")
+                                    .arg(metaObject()->className()).arg(id);
+        return false;
+    }
+
+    invalidateQueries(tableName());
+    invalidateSharedRow(tableName(), id);
+    SqliteMaintenance::recordWrite(tableName(), query.numRowsAffected());
+    m_version = QVariant(); // Moved by the database, read by the next load or refresh
+
+    if (caches.isEmpty())
+        return true;
+
+    return applyCounterCaches(caches, before, storedValues(caches)) && transaction.commit();
+}
+
+bool Model::deleteFromDatabase()
+{
+    ModelStorage* storage = ModelStorage::storage(metaObject());
+    QList<CounterCache> caches = storage == nullptr ? counterCaches() : QList<CounterCache>();
+    ScopedTransaction transaction(ScopedTransaction::Write, !caches.isEmpty());
+    QVariantHash before = caches.isEmpty() ? QVariantHash() : storedValues(caches);
+
+    if (storage != nullptr ? !storage->remove(tableName(), id()) : !execDML(deleteQuery()))
+        return false;
+
+    if (!caches.isEmpty() && (!applyCounterCaches(caches, before, QVariantHash()) || !transaction.commit()))
+        return false;
+
+    deleteLater();
+    return true;
+}
+
+bool Model::load(model_id_t id, bool eagerLoad)
+{
+    return loadRow(id, eagerLoad, nullptr);
+}
+
+bool Model::loadWith(model_id_t id, const QStringList& fetchPlan)
+{
+    const FetchPlan plan = compileFetchPlan(fetchPlan);
+    return loadRow(id, false, &plan);
+}
+
+bool Model::loadRow(model_id_t id, bool eagerLoad, const FetchPlan* plan)
+{
+    ModelStorage* storage = ModelStorage::storage(metaObject());
+    // A storage can't join, each related Model is loaded from its own storage
+    RowPlan rowPlan = planRow(eagerLoad, plan, storage == nullptr);
+
+    if (storage != nullptr) {
+        QVariantHash row;
+
+        if (!storage->load(tableName(), id, row))
+            return false;
+
+        if (!readRow([&row](const QString& column) { return row.value(column); }, QString(), rowPlan))
+            return false;
+
+        setId(id);
+        return true;
+    }
+
+    QString versionColumn = classInfo("version");
+    // Inside a transaction the cache may hold the row as it was before this transaction
+    // wrote it, and the rows read may never be committed. The read transaction opened
+    // below only reads committed rows
+    bool shared = SharedRowCache::isAttached() && !ScopedTransaction::inProgress();
+    quint32 cacheStamp = SharedRowCache::stamp(tableName(), id);
+    QVariantHash cachedRow;
+
+    // The shared cache only holds this Model's own columns, so joined rows are always read
+    if (shared && rowPlan.joined.isEmpty() && SharedRowCache::lookup(tableName(), id, cachedRow)) {
+        if (!readRow([&cachedRow](const QString& column) { return cachedRow.value(column); }, QString(), rowPlan))
+            return false;
+
+        m_version = cachedRow.value("row_version");
+        setId(id);
+        return true;
+    }
+
+    auto cacheRow = [&, this](const RowReader& column) {
+        if (!shared)
+            return;
+
+        QVariantHash row;
+
+        forEachProperty([&row, &column](auto metaProperty) {
+            row.insert(metaProperty.name(), column(metaProperty.name()));
+        });
+
+        if (!versionColumn.isNull())
+            row.insert("row_version", column("row_version"));
+
+        SharedRowCache::insert(tableName(), id, row, cacheStamp);
+    };
+
+    // Related Models loaded by their own SELECT must see the same commit as this row
+    ScopedTransaction transaction(ScopedTransaction::Read, selectsRelated(rowPlan));
+    QSqlQuery query;
+    QStringList queryStr;
+    QStringList joins;
+    queryStr << "SELECT ";
+
+    forEachProperty([&queryStr](auto metaProperty){
+        queryStr << "t." << metaProperty.name() << " AS " << metaProperty.name() << ",";
+    });
+
+    if (!versionColumn.isNull())
+        queryStr << "t." << versionColumn << " AS row_version,";
+
+    for (auto it = rowPlan.joined.cbegin(); it != rowPlan.joined.cend(); ++it) {
+        QString alias = QString("j%1").arg(joins.size());
+        QString prefix = QString("%1__").arg(it.key());
+        queryStr << alias << ".id AS " << prefix << "id,";
+
+        it.value()->forEachProperty([&](auto relatedProperty) {
+            queryStr << alias << "." << relatedProperty.name() << " AS " << prefix << relatedProperty.name() << ",";
+        });
+
+        joins << QString(" LEFT JOIN %1 %2 ON %2.id = t.%3").arg(it.value()->tableName(), alias, it.key());
+    }
+
+    queryStr.removeLast(); // trailing comma
+    queryStr << " FROM " << tableName() << " t" << joins.join("") << " WHERE t.id = :id";
+
+#ifdef QTMODELLIBRARY_NATIVE_SQLITE
+    if (SqliteBackend::isAvailable()) {
+        QVariantHash row;
+
+        if (!SqliteBackend::selectRow(queryStr.join(""), id, row)) {
+            qDeleteAll(rowPlan.joined);
+            return false;
+        }
+
+        if (!readRow([&row](const QString& column) { return row.value(column); }, QString(), rowPlan))
+            return false;
+
+        cacheRow([&row](const QString& column) { return row.value(column); });
+        m_version = row.value("row_version");
+        setId(id);
+        return true;
+    }
+#endif
+
+    if (!query.prepare(queryStr.join(""))) {
+        qCritical() << "Could not prepare SELECT query:" << query.lastError().text();
+        qDeleteAll(rowPlan.joined);
+        return false;
+    }
+
+    query.bindValue(":id", id);
+
+    if (!query.exec()) {
+        qCritical() << "Could not execute SELECT query:" << query.lastError().text();
+        qDeleteAll(rowPlan.joined);
+        return false;
+    }
+
+    if (!query.first()) {
+        qDeleteAll(rowPlan.joined);
+        return false;
+    }
+
+    if (!readRow([&query](const QString& column) { return query.value(column); }, QString(), rowPlan))
+        return false;
+
+    cacheRow([&query](const QString& column) { return query.value(column); });
+    m_version = versionColumn.isNull() ? QVariant() : query.value("row_version");
+    setId(id);
+    return true;
+}
+
+Model::RowPlan Model::planRow(bool eagerLoad, const FetchPlan* plan, bool allowJoin) const
+{
+    // A separate SELECT costs about as much as fetching this many extra columns, far
+    // less for an in-process SQLite statement than for a round trip to a server
+    double roundTripCost = QSqlDatabase::database().driverName() == "QSQLITE" ? 8 : 32;
+    RowPlan rowPlan{eagerLoad, plan, {}, {}};
+
+    forEachProperty([&, this](auto metaProperty) {
+        if (!isPropertyModel(metaProperty))
+            return;
+
+        QString name = metaProperty.name();
+        QString hint = classInfo(QString("fetch:%1").arg(name));
+        bool requested = plan ? plan->contains(name) : eagerLoad;
+        const QMetaObject* relatedMetaObject = metaProperty.metaType().metaObject();
+        int rowWidth = relatedMetaObject->propertyCount() - relatedMetaObject->propertyOffset() + 1;
+        FetchStrategy strategy;
+
+        // An explicit fetch plan wins over a "lazy" hint, eagerLoad = true doesn't
+        if (!requested || (hint == "lazy" && !plan))
+            strategy = FetchStrategy::Lazy;
+        else if (hint == "select" || !allowJoin)
+            strategy = FetchStrategy::Select;
+        else if (hint == "join")
+            strategy = FetchStrategy::Join;
+        else
+            strategy = relationStatistics().plan(metaObject()->className(), name, rowWidth, roundTripCost);
+
+        if (strategy == FetchStrategy::Join)
+            rowPlan.joined.insert(name, createRelatedInstance(metaProperty));
+
+        rowPlan.strategies.insert(name, strategy);
+    });
+
+    return rowPlan;
+}
+
+Model::RowPlan Model::planJoinedRow(const RowPlan& rowPlan, const QString& relation, FetchPlan& relatedPlan) const
+{
+    Model* joined = rowPlan.joined.value(relation);
+
+    if (rowPlan.fetchPlan)
+        relatedPlan = joined->compileFetchPlan(rowPlan.fetchPlan->value(relation));
+
+    return joined->planRow(rowPlan.eagerLoad, rowPlan.fetchPlan ? &relatedPlan : nullptr, false);
+}
+
+bool Model::selectsRelated(const RowPlan& rowPlan) const
+{
+    if (rowPlan.strategies.values().contains(FetchStrategy::Select))
+        return true;
+
+    // Joined Models never join, so their requested relations are all selected
+    for (auto it = rowPlan.joined.cbegin(); it != rowPlan.joined.cend(); ++it) {
+        FetchPlan relatedPlan;
+
+        if (planJoinedRow(rowPlan, it.key(), relatedPlan).strategies.values().contains(FetchStrategy::Select))
+            return true;
+    }
+
+    return false;
+}
+
+bool Model::readRow(const RowReader& column, const QString& prefix, const RowPlan& rowPlan)
+{
+    // The joined instances belong to this read until they are assigned to their property
+    std::map<QString, std::unique_ptr<Model>> joinedModels;
+
+    for (auto it = rowPlan.joined.cbegin(); it != rowPlan.joined.cend(); ++it)
+        joinedModels[it.key()].reset(it.value());
+
+    for (int i = metaObject()->propertyOffset(); i < metaObject()->propertyCount(); ++i) {
+        QMetaProperty metaProperty = metaObject()->property(i);
+        QString name = metaProperty.name();
+        QVariant dbValue = column(prefix + name);
+        FetchStrategy strategy = rowPlan.strategies.value(name, FetchStrategy::Lazy);
+        bool eager = isPropertyModel(metaProperty) ? strategy != FetchStrategy::Lazy
+                                                   : rowPlan.fetchPlan || rowPlan.eagerLoad;
+        auto joinedModel = joinedModels.find(name);
+        std::unique_ptr<Model> joined = joinedModel != joinedModels.end() ? std::move(joinedModel->second) : nullptr;
+        std::unique_ptr<Model> related; // The instance written to the property, if any
+
+        bool converted = true;
+
+        if (isPropertyModel(metaProperty))
+            relationStatistics().record(metaObject()->className(), name, !dbValue.isNull(), strategy);
+        else
+            dbValue = propertyValue(metaProperty, dbValue, &converted);
+
+        if (!converted)
+            return false;
+
+        if (isPropertyModel(metaProperty) && dbValue.typeId() == QMetaType::LongLong) {
+            model_id_t relatedId = dbValue.toULongLong();
+
+            if (strategy == FetchStrategy::Join) {
+                // A dangling foreign key joins a row of NULLs
+                bool found = !column(QString("%1__id").arg(name)).isNull();
+                FetchPlan relatedPlan;
+                RowPlan joinedPlan = planJoinedRow(rowPlan, name, relatedPlan);
+
+                if (found && joined->readRow(column, QString("%1__").arg(name), joinedPlan)) {
+                    joined->setId(relatedId);
+                    related = std::move(joined);
+                }
+            } else if (strategy == FetchStrategy::Select) {
+                std::unique_ptr<Model> selected(createRelatedInstance(metaProperty));
+                bool loaded = rowPlan.fetchPlan ? selected->loadWith(relatedId, rowPlan.fetchPlan->value(name))
+                                                : selected->load(relatedId, rowPlan.eagerLoad);
+
+                if (loaded)
+                    related = std::move(selected);
+            } else {
+                setProperty(QString("%1Id").arg(name).toLocal8Bit(), dbValue);
+            }
+
+            if (related != nullptr)
+                dbValue = QVariant::fromValue(related.get());
+        }
+
+        if (!metaProperty.write(this, dbValue)) {
+            if (!eager)
+                continue;
+
+            qWarning() << QString(R"(Could not set property "%1")").arg(name);
+            return false;
+        }
+
+        related.release(); // Now referenced by the property
+    }
+
+    // The setters mark what they write as modified, but the Model now matches its row
+    m_modifiedProperties.clear();
+    return true;
+}
+
+Model::FetchPlan Model::compileFetchPlan(const QStringList& paths) const
+{
+    static QMutex mutex;
+    static QHash<QString, FetchPlan> compiledPlans;
+
+    QStringList normalized = paths;
+    normalized.sort();
+    normalized.removeDuplicates();
+    QString key = QString("%1|%2").arg(metaObject()->className(), normalized.join(','));
+    QMutexLocker locker(&mutex);
+    auto compiled = compiledPlans.constFind(key);
+
+    if (compiled != compiledPlans.constEnd())
+        return compiled.value();
+
+    FetchPlan plan;
+
+    for (const QString& path : normalized) {
+        QString relation = path.section('.', 0, 0);
+        QString subPath = path.section('.', 1);
+        int propertyIndex = metaObject()->indexOfProperty(relation.toLocal8Bit());
+
+        if (propertyIndex < 0 || !isPropertyModel(metaObject()->property(propertyIndex))) {
+            qWarning() << QString(R"(Ignoring fetch path "%1": "%2" is not a related Model of %3)")
+                              .arg(path, relation, metaObject()->className());
+            continue;
+        }
+
+        QStringList& subPaths = plan[relation]; // Creates the entry even for leaf paths
+
+        if (!subPath.isEmpty())
+            subPaths << subPath;
+    }
+
+    compiledPlans.insert(key, plan);
+    return plan;
+}
+
+
+bool Model::refresh()
+{
+    return refresh(QList<Model*>{this});
+}
+
+bool Model::refresh(const QList<Model*>& models)
+{
+    QHash<const QMetaObject*, QList<Model*>> modelsByType;
+    bool refreshed = true;
+
+    for (Model* model : models) {
+        if (model->isSaved())
+            modelsByType[model->metaObject()].append(model);
+    }
+
+    for (const QList<Model*>& batch : std::as_const(modelsByType)) {
+        Model* first = batch.first();
+        QString versionColumn = first->classInfo("version");
+        QHash<model_id_t, Model*> stale;
+
+        // Storages don't keep versions, every row is read again
+        if (ModelStorage* storage = ModelStorage::storage(first->metaObject())) {
+            for (Model* model : batch) {
+                QVariantHash row;
+
+                if (storage->load(first->tableName(), model->id(), row))
+                    refreshed = model->applyRow([&row](const QString& column) { return row.value(column); }) && refreshed;
+                else
+                    refreshed = false;
+            }
+
+            continue;
+        }
+
+        for (Model* model : batch)
+            stale.insert(model->id(), model);
+
+        // With a version column, only the rows whose version moved are read again
+        if (!versionColumn.isNull()) {
+            QSqlQuery query = first->selectByIds(QString("id, %1 AS row_version").arg(versionColumn), stale.keys());
+
+            // The other types can still be refreshed
+            if (!query.isActive()) {
+                refreshed = false;
+                continue;
+            }
+
+            while (query.next()) {
+                Model* model = stale.value(query.value("id").toULongLong());
+
+                if (model != nullptr && model->m_version.isValid() && model->m_version == query.value("row_version"))
+                    stale.remove(model->id());
+            }
+        }
+
+        if (stale.isEmpty())
+            continue;
+
+        QStringList columns{"id"};
+
+        first->forEachProperty([&columns](auto metaProperty) {
+            columns << metaProperty.name();
+        });
+
+        if (!versionColumn.isNull())
+            columns << QString("%1 AS row_version").arg(versionColumn);
+
+        QSqlQuery query = first->selectByIds(columns.join(','), stale.keys());
+
+        if (!query.isActive()) {
+            refreshed = false;
+            continue;
+        }
+
+        while (query.next()) {
+            Model* model = stale.take(query.value("id").toULongLong());
+
+            if (model != nullptr)
+                refreshed = model->applyRow([&query](const QString& column) { return query.value(column); }) && refreshed;
+        }
+
+        // The remaining Models were deleted from the database
+        if (!stale.isEmpty())
+            refreshed = false;
+    }
+
+    return refreshed;
+}
+
+bool Model::loadRelated(const QString& propertyName, bool eagerLoad)
+{
+    QString idPropName = QString("%1Id").arg(propertyName);
+
+    if (!dynamicPropertyNames().contains(idPropName.toUtf8()))
+        return false;
+
+    model_id_t relatedId = property(idPropName.toLocal8Bit()).toUInt();
+    int relatedPropertyIndex = metaObject()->indexOfProperty(propertyName.toLocal8Bit());
+    QMetaProperty relatedMetaProperty = metaObject()->property(relatedPropertyIndex);
+    QList<Model*> batch = pendingSiblings(relatedMetaProperty);
+
+    // Resolve the relation of the siblings loaded together with this Model as well
+    if (batch.size() > 1 && loadRelatedBatch(batch, relatedMetaProperty, eagerLoad)) {
+        if (relatedMetaProperty.read(this).value<Model*>() == nullptr)
+            return false;
+
+        relationStatistics().resolved(metaObject()->className(), propertyName);
+        return true;
+    }
+
+    Model* related = createRelatedInstance(relatedMetaProperty);
+
+    if (!related->load(relatedId, eagerLoad))
+        return false;
+
+    relatedMetaProperty.write(this, QVariant::fromValue(related));
+    relationStatistics().resolved(metaObject()->className(), propertyName);
+    return true;
+}
+
+bool Model::createSearchIndex() const
+{
+    QStringList columns = classInfo("searchable").split(',', Qt::SkipEmptyParts);
+    QString index = QString("%1_fts").arg(tableName());
+
+    for (QString& column : columns)
+        column = column.trimmed();
+
+    if (columns.isEmpty()) {
+        qWarning() << metaObject()->className() << "doesn't declare any searchable property";
+        return false;
+    }
+
+    if (QSqlDatabase::database().driverName() != "QSQLITE") {
+        qWarning() << "Full-text search requires SQLite";
+        return false;
+    }
+
+    QSqlQuery query;
+
+    if (!query.exec(QString("SELECT 1 FROM sqlite_master WHERE name = '%1'").arg(index))) {
+        qCritical() << "Could not look up the search index:" << query.lastError().text();
+        return false;
+    }
+
+    if (query.next())
+        return true;
+
+    QStringList oldColumns;
+    QStringList newColumns;
+
+    for (const QString& column : std::as_const(columns)) {
+        oldColumns << QString("old.%1").arg(column);
+        newColumns << QString("new.%1").arg(column);
+    }
+
+    QString insertRow = QString("INSERT INTO %1(rowid, %2) VALUES (new.id, %3);")
+                            .arg(index, columns.join(", "), newColumns.join(", "));
+    QString deleteRow = QString("INSERT INTO %1(%1, rowid, %2) VALUES ('delete', old.id, %3);")
+                            .arg(index, columns.join(", "), oldColumns.join(", "));
+    QStringList statements{
+        QString("CREATE VIRTUAL TABLE %1 USING fts5(%2, content='%3', content_rowid='id')")
+            .arg(index, columns.join(", "), tableName()),
+        QString("CREATE TRIGGER %1_ai AFTER INSERT ON %2 BEGIN %3 END").arg(index, tableName(), insertRow),
+        QString("CREATE TRIGGER %1_ad AFTER DELETE ON %2 BEGIN %3 END").arg(index, tableName(), deleteRow),
+        QString("CREATE TRIGGER %1_au AFTER UPDATE ON %2 BEGIN %3 %4 END").arg(index, tableName(), deleteRow, insertRow),
+        QString("INSERT INTO %1(%1) VALUES ('rebuild')").arg(index),
+    };
+
+    ScopedTransaction transaction(ScopedTransaction::Write, true);
+
+    for (const QString& statement : std::as_const(statements)) {
+        if (!query.exec(statement)) {
+            qCritical() << "Could not create the search index:" << query.lastError().text();
+            return false;
+        }
+    }
+
+    return transaction.commit();
+}
+
+QList<Model*> Model::search(const QString& terms, int limit, bool eagerLoad) const
+{
+    QString index = QString("%1_fts").arg(tableName());
+    QStringList queryStr;
+    queryStr << "SELECT t.id AS id,";
+
+    forEachProperty([&queryStr](auto metaProperty) {
+        queryStr << "t." << metaProperty.name() << " AS " << metaProperty.name() << ",";
+    });
+
+    queryStr.removeLast(); // trailing comma
+    queryStr << " FROM " << index << " JOIN " << tableName() << " t ON t.id = " << index << ".rowid"
+             << " WHERE " << index << " MATCH ? ORDER BY " << index << ".rank LIMIT ?";
+    // The index is kept in sync with the Model table by triggers
+    return cachedQuery(queryStr.join(""), QVariantList{terms, limit}, QStringList{tableName()}, eagerLoad);
+}
+
+QList<Model*> Model::find(const QString& filter, const QVariantList& bindValues, bool eagerLoad) const
+{
+    if (ModelStorage* storage = ModelStorage::storage(metaObject())) {
+        QList<Model*> models;
+        static const QRegularExpression equality(R"(^\s*(\w+)\s*=\s*\?\s*$)");
+        QRegularExpressionMatch match = equality.match(filter);
+
+        // Storages can only look up rows by the value of a column
+        if (!match.hasMatch() || bindValues.size() != 1) {
+            qWarning() << "Storages only support filters of the form \"<column> = ?\", not" << filter;
+            return models;
+        }
+
+        for (model_id_t id : storage->query(tableName(), match.captured(1), bindValues.first())) {
+            QVariantHash row;
+
+            if (!storage->load(tableName(), id, row))
+                continue;
+
+            row.insert("id", qulonglong(id));
+            Model* model = fromRow(*metaObject(), [&row](const QString& column) { return row.value(column); }, eagerLoad);
+
+            if (model != nullptr)
+                models << model;
+        }
+
+        makeSiblings(models);
+        return models;
+    }
+
+    QStringList queryStr;
+    queryStr << "SELECT id";
+
+    forEachProperty([&queryStr](auto metaProperty) {
+        queryStr << ", " << metaProperty.name();
+    });
+
+    queryStr << " FROM " << tableName();
+
+    if (!filter.isEmpty())
+        queryStr << " WHERE " << filter;
+
+    queryStr << " ORDER BY id";
+    return cachedQuery(queryStr.join(""), bindValues, QStringList{tableName()}, eagerLoad);
+}
+
+QHash<model_id_t, Model::Preview> Model::preview(const QString& relation, const QList<model_id_t>& parentIds, int limit,
+                                                 const QString& orderBy) const
+{
+    QHash<model_id_t, Preview> previews;
+    int propertyIndex = metaObject()->indexOfProperty(relation.toLocal8Bit());
+
+    if (propertyIndex < 0 || !isPropertyModel(metaObject()->property(propertyIndex))) {
+        qWarning() << QString(R"("%1" is not a related Model of %2)").arg(relation, metaObject()->className());
+        return previews;
+    }
+
+    for (model_id_t parentId : parentIds)
+        previews.insert(parentId, Preview());
+
+    if (parentIds.isEmpty())
+        return previews;
+
+    QVariantList bindValues;
+    QStringList queryStr;
+    queryStr << "SELECT * FROM (SELECT id";
+
+    forEachProperty([&queryStr](auto metaProperty) {
+        queryStr << ", " << metaProperty.name();
+    });
+
+    if (QString versionColumn = classInfo("version"); !versionColumn.isNull())
+        queryStr << ", " << versionColumn << " AS row_version";
+
+    // Every parent with children gets at least one row, which carries its count
+    queryStr << ", ROW_NUMBER() OVER (PARTITION BY " << relation << " ORDER BY " << orderBy << ") AS preview_rank"
+             << ", COUNT(*) OVER (PARTITION BY " << relation << ") AS preview_count"
+             << " FROM " << tableName() << " WHERE " << idSetCondition(relation, parentIds, bindValues)
+             << ") ranked WHERE preview_rank <= ? ORDER BY " << relation << ", preview_rank";
+    bindValues << limit;
+    QSqlQuery query;
+    query.setForwardOnly(true);
+
+    if (!query.prepare(queryStr.join(""))) {
+        qCritical() << "Could not prepare preview query:" << query.lastError().text();
+        return previews;
+    }
+
+    for (const QVariant& value : std::as_const(bindValues))
+        query.addBindValue(value);
+
+    if (!query.exec()) {
+        qCritical() << "Could not execute preview query:" << query.lastError().text();
+        return previews;
+    }
+
+    QList<Model*> children;
+
+    while (query.next()) {
+        Preview& preview = previews[query.value(relation).toULongLong()];
+        preview.count = query.value("preview_count").toLongLong();
+        Model* child = fromRow(*metaObject(), [&query](const QString& column) { return query.value(column); }, false);
+
+        if (child != nullptr) {
+            preview.children << child;
+            children << child;
+        }
+    }
+
+    makeSiblings(children);
+    return previews;
+}
+
+bool Model::isPropertyModel(const QMetaProperty& metaProperty)
+{
+    auto metaObject = metaProperty.metaType().metaObject();
+    return metaObject != nullptr && metaObject->inherits(&staticMetaObject);
+}
+
+void Model::setId(model_id_t id)
+{
+    if (id == m_id)
+        return;
+
+    m_id = id;
+    emit idChanged();
+}
+
+void Model::setModified(const QString& propertyName)
+{
+    m_modifiedProperties.insert(propertyName);
+}
+
+const QSet<const QString>& Model::modifiedProperties() const
+{
+    return m_modifiedProperties;
+}
+
+QVariant Model::insertQuery() const
+{
+    QStringList queryStr;
+    queryStr << "INSERT INTO " << tableName() << " (";
+
+    forEachProperty([&queryStr](auto metaProperty) {
+        queryStr << metaProperty.name() << ",";
+    });
+
+    queryStr.removeLast(); // trailing comma
+    queryStr << ") VALUES (";
+
+    forEachProperty([&queryStr](auto metaProperty) {
+        queryStr << QString(":%1").arg(metaProperty.name()) << ",";
+    });
+
+    queryStr.removeLast();
+    queryStr << ")";
+    QSqlQuery query;
+
+    if (!query.prepare(queryStr.join(""))) {
+        qCritical() << "Could not prepare INSERT query:" << query.lastError().text();
+        return QVariant();
+    }
+
+    forEachProperty([&query, this](auto metaProperty) {
+        query.bindValue(QString(":%1").arg(metaProperty.name()), databaseValue(metaProperty));
+    });
+
+    return QVariant::fromValue(query);
+}
+
+QVariant Model::updateQuery() const
+{
+    return versionedUpdateQuery(QVariant());
+}
+
+QVariant Model::versionedUpdateQuery(const QVariant& expectedVersion) const
+{
+    QString versionColumn = expectedVersion.isValid() ? classInfo("version") : QString();
+    QStringList queryStr;
+    queryStr << "UPDATE " << tableName() << " SET ";
+
+    for (const QString& propertyName : modifiedProperties())
+        queryStr << propertyName << QString(" = :%1,").arg(propertyName); // Don't put extra space at the end
+
+    queryStr.last().chop(1); // remove trailing comma
+    queryStr << " WHERE id = :id";
+
+    if (!versionColumn.isEmpty())
+        queryStr << " AND " << versionColumn << " = :expected_version";
+
+    QSqlQuery query;
+
+    if (!query.prepare(queryStr.join(""))) {
+        qCritical() << "Could not prepare UPDATE query:" << query.lastError().text();
+        return QVariant();
+    }
+
+    for (const QString& propertyName : modifiedProperties()) {
+        int propertyIndex = metaObject()->indexOfProperty(propertyName.toLocal8Bit());
+        QMetaProperty property = metaObject()->property(propertyIndex);
+        QVariant value = property.read(this);
+        QString paramName = QString(":%1").arg(propertyName);
+
+        if (value.canConvert<Model*>()) {
+            Model* model = value.value<Model*>();
+
+            if (!model->isSaved() && !model->insert())
+                return QVariant();
+            else if (model->isModified() && !model->update())
+                return QVariant();
+
+            query.bindValue(paramName, model->id());
+        } else {
+            query.bindValue(paramName, databaseValue(property));
+        }
+    }
+
+    query.bindValue(":id", id());
+
+    if (!versionColumn.isEmpty())
+        query.bindValue(":expected_version", expectedVersion);
+
+    return QVariant::fromValue(query);
+}
+
+QVariant Model::deleteQuery() const
+{
+    QString queryStr = QString("DELETE FROM %1 WHERE id = ?").arg(tableName());
+    QSqlQuery query;
+
+    if (!query.prepare(queryStr)) {
+        qCritical() << "Couldn't prepare DELETE query:" << query.lastError().text();
+        return QVariant();
+    }
+
+    query.addBindValue(m_id);
+    return QVariant::fromValue(query);
+}
+
+QSqlQuery Model::selectByIds(const QString& columns, const QList<model_id_t>& ids) const
+{
+    QVariantList bindValues;
+    QString condition = idSetCondition("id", ids, bindValues);
+    QSqlQuery query;
+
+    if (!query.prepare(QString("SELECT %1 FROM %2 WHERE %3").arg(columns, tableName(), condition))) {
+        qCritical() << "Could not prepare SELECT query:" << query.lastError().text();
+        return query;
+    }
+
+    for (const QVariant& value : std::as_const(bindValues))
+        query.addBindValue(value);
+
+    if (!query.exec())
+        qCritical() << "Could not execute SELECT query:" << query.lastError().text();
+
+    return query;
+}
+
+QString Model::idSetCondition(const QString& column, const QList<model_id_t>& ids, QVariantList& bindValues)
+{
+    // Past this size a list of placeholders hits SQLite's host parameter limit and
+    // costs PostgreSQL more to plan than the whole set as a single parameter
+    constexpr qsizetype largeIdSet = 100;
+    QString driverName = QSqlDatabase::database().driverName();
+    QStringList placeholders;
+
+    if (ids.size() > largeIdSet && (driverName == "QSQLITE" || driverName == "QPSQL")) {
+        QStringList values;
+
+        for (model_id_t id : ids)
+            values << QString::number(id);
+
+        // The ids are bound as one JSON array (SQLite) or array literal (PostgreSQL)
+        if (driverName == "QSQLITE") {
+            bindValues << QString("[%1]").arg(values.join(','));
+            return QString("%1 IN (SELECT value FROM json_each(?))").arg(column);
+        }
+
+        bindValues << QString("{%1}").arg(values.join(','));
+        return QString("%1 = ANY(CAST(? AS bigint[]))").arg(column);
+    }
+
+    for (model_id_t id : ids) {
+        placeholders << "?";
+        bindValues << id;
+    }
+
+    return QString("%1 IN (%2)").arg(column, placeholders.join(','));
+}
+
+QList<Model*> Model::cachedQuery(const QString& queryStr, const QVariantList& bindValues, const QStringList& tables,
+                                 bool eagerLoad) const
+{
+    QList<Model*> models;
+    QList<model_id_t> ids;
+
+    // Inside a transaction the cache may lack this transaction's own writes
+    bool cacheable = QueryCache::isEnabled() && !ScopedTransaction::inProgress();
+
+    if (cacheable && QueryCache::lookup(queryStr, bindValues, ids)) {
+        if (ids.isEmpty())
+            return models;
+
+        QStringList columns("id");
+
+        forEachProperty([&columns](auto metaProperty) {
+            columns << metaProperty.name();
+        });
+
+        if (!classInfo("version").isNull())
+            columns << QString("%1 AS row_version").arg(classInfo("version"));
+
+        // Large cached results are read back with a single id set parameter
+        QSqlQuery query = selectByIds(columns.join(','), ids);
+        QHash<model_id_t, Model*> byId;
+
+        while (query.next()) {
+            Model* model = fromRow(*metaObject(), [&query](const QString& column) { return query.value(column); }, eagerLoad);
+
+            if (model != nullptr)
+                byId.insert(model->id(), model);
+        }
+
+        // Rows deleted behind the cache's back are simply missing from the result
+        for (model_id_t id : std::as_const(ids)) {
+            if (Model* model = byId.value(id))
+                models << model;
+        }
+
+        makeSiblings(models);
+        return models;
+    }
+
+    quint64 generation = QueryCache::generation(tables);
+    QSqlQuery query;
+    query.setForwardOnly(true);
+
+    if (!query.prepare(queryStr)) {
+        qCritical() << "Could not prepare query:" << query.lastError().text();
+        return models;
+    }
+
+    for (const QVariant& value : bindValues)
+        query.addBindValue(value);
+
+    if (!query.exec()) {
+        qCritical() << "Could not execute query:" << query.lastError().text();
+        return models;
+    }
 
-bool Model::isSaved() const
-{
-    return m_id != 0;
-}
+    QString versionColumn = classInfo("version");
 
-bool Model::isModified() const
-{
-    return !m_modifiedProperties.isEmpty();
+    // The query is the application's, which selects the version column by its own name
+    while (query.next()) {
+        Model* model = fromRow(*metaObject(), [&query, &versionColumn](const QString& column) {
+            return query.value(column == "row_version" ? versionColumn : column);
+        }, eagerLoad);
+
+        if (model != nullptr) {
+            models << model;
+            ids << model->id();
+        }
+    }
+
+    // A result read inside a transaction may include writes that are rolled back
+    if (cacheable)
+        QueryCache::insert(queryStr, bindValues, tables, ids, generation);
+    makeSiblings(models);
+    return models;
 }
 
-bool Model::insert()
+void Model::addSibling(std::shared_ptr<SiblingGroup>& group, Model* model)
 {
-    if (isSaved())
-        return false;
+    if (!group)
+        group = std::make_shared<SiblingGroup>();
 
-    return execDML(insertQuery());
+    group->append(model);
+    model->m_siblings = group;
 }
 
-bool Model::update()
+void Model::makeSiblings(const QList<Model*>& models)
 {
-    if (!isSaved()) {
-        qWarning() << "Model is not saved";
-        return false;
-    }
+    if (models.size() < 2)
+        return;
 
-    if (!isModified())
-        return false;
+    std::shared_ptr<SiblingGroup> group;
 
-    return execDML(updateQuery());
+    for (Model* model : models)
+        addSibling(group, model);
 }
 
-bool Model::deleteFromDatabase()
+QList<Model*> Model::pendingSiblings(const QMetaProperty& relation)
 {
-    if (!execDML(deleteQuery()))
-        return false;
+    QList<Model*> batch{this};
+    const QMetaObject* relatedMetaObject = relation.metaType().metaObject();
 
-    deleteLater();
-    return true;
+    // Related Models kept in a storage are loaded by id anyway
+    if (!m_siblings || ModelStorage::storage(relatedMetaObject) != nullptr)
+        return batch;
+
+    QString batchSize = classInfo(QString("batchSize:%1").arg(relation.name()));
+    int maxBatchSize = batchSize.isEmpty() ? 50 : batchSize.toInt();
+    QByteArray idProperty = QString("%1Id").arg(relation.name()).toLocal8Bit();
+
+    for (const QPointer<Model>& sibling : std::as_const(*m_siblings)) {
+        if (batch.size() >= maxBatchSize)
+            break;
+
+        if (sibling.isNull() || sibling == this || !sibling->dynamicPropertyNames().contains(idProperty))
+            continue;
+
+        // Already loaded, either explicitly or by an earlier batch
+        if (relation.read(sibling).value<Model*>() == nullptr)
+            batch << sibling;
+    }
+
+    return batch;
 }
 
-bool Model::load(model_id_t id, bool eagerLoad)
+bool Model::loadRelatedBatch(const QList<Model*>& models, const QMetaProperty& relation, bool eagerLoad)
 {
-    QSqlQuery query;
-    QStringList queryStr;
-    queryStr << "SELECT ";
+    std::unique_ptr<Model> prototype(models.first()->createRelatedInstance(relation));
+    QByteArray idProperty = QString("%1Id").arg(relation.name()).toLocal8Bit();
+    QList<model_id_t> ids;
+    QSet<model_id_t> seen;
 
-    forEachProperty([&queryStr](auto metaProperty){
-        queryStr << metaProperty.name() << ",";
+    for (Model* model : models) {
+        model_id_t id = model->property(idProperty).toULongLong();
+
+        if (!seen.contains(id)) {
+            seen.insert(id);
+            ids << id;
+        }
+    }
+
+    QStringList columns("id");
+
+    prototype->forEachProperty([&columns](auto metaProperty) {
+        columns << metaProperty.name();
     });
 
-    queryStr.removeLast(); // trailing comma
-    queryStr << " FROM " << tableName() << " WHERE id = :id";
+    QString versionColumn = prototype->classInfo("version");
+    QStringList selected = columns;
 
-    if (!query.prepare(queryStr.join(""))) {
-        qCritical() << "Could not prepare SELECT query:" << query.lastError().text();
-        return false;
+    if (!versionColumn.isNull()) {
+        selected << QString("%1 AS row_version").arg(versionColumn);
+        columns << "row_version";
     }
 
-    query.bindValue(":id", id);
+    QSqlQuery query = prototype->selectByIds(selected.join(','), ids);
 
-    if (!query.exec()) {
-        qCritical() << "Could not execute SELECT query:" << query.lastError().text();
+    if (!query.isActive())
         return false;
+
+    QHash<model_id_t, QVariantHash> rows;
+
+    while (query.next()) {
+        QVariantHash row;
+
+        for (const QString& column : std::as_const(columns))
+            row.insert(column, query.value(column));
+
+        rows.insert(row.value("id").toULongLong(), row);
     }
 
-    if (!query.first())
-        return false;
+    QList<Model*> loaded;
+
+    // Each Model owns its related instance, even when siblings share the related row
+    for (Model* model : models) {
+        auto row = rows.constFind(model->property(idProperty).toULongLong());
+
+        if (row == rows.constEnd())
+            continue;
+
+        Model* related = fromRow(*prototype->metaObject(), [&row](const QString& column) { return row->value(column); }, eagerLoad);
 
+        if (related != nullptr && relation.write(model, QVariant::fromValue(related)))
+            loaded << related;
+        else
+            delete related;
+    }
+
+    // The related Models were loaded together, so their own relations batch as well
+    makeSiblings(loaded);
+    return true;
+}
+
+bool Model::applyRow(const RowReader& column)
+{
     for (int i = metaObject()->propertyOffset(); i < metaObject()->propertyCount(); ++i) {
         QMetaProperty metaProperty = metaObject()->property(i);
-        QVariant dbValue = query.value(metaProperty.name());
+        QString name = metaProperty.name();
+        QVariant dbValue = column(name);
 
-        if (isPropertyModel(metaProperty) && dbValue.typeId() == QMetaType::LongLong) {
-            if (eagerLoad) {
-                Model* related = createRelatedInstance(metaProperty);
+        // Local edits win until they are saved or discarded
+        if (m_modifiedProperties.contains(name)) {
+            qWarning() << QString(R"(Not refreshing property "%1" of Model %2, which was modified)").arg(name).arg(id());
+            continue;
+        }
 
-                if (related->load(dbValue.toUInt(), eagerLoad)) {
-                    dbValue = QVariant::fromValue(related);
-                }
-            } else {
-                setProperty(QString("%1Id").arg(metaProperty.name()).toLocal8Bit(), dbValue);
+        if (isPropertyModel(metaProperty)) {
+            Model* related = metaProperty.read(this).value<Model*>();
+            QByteArray idProperty = QString("%1Id").arg(name).toLocal8Bit();
+            QVariant currentId = related != nullptr ? QVariant(qlonglong(related->id())) : property(idProperty);
+
+            // Related instances are kept as long as the foreign key didn't move
+            if (dbValue.isNull() ? currentId.isNull() : currentId.toULongLong() == dbValue.toULongLong())
+                continue;
+
+            if (related == nullptr || dbValue.isNull()) {
+                setProperty(idProperty, dbValue);
+
+                if (related != nullptr)
+                    metaProperty.write(this, QVariant::fromValue<Model*>(nullptr));
+
+                continue;
+            }
+
+            Model* moved = createRelatedInstance(metaProperty);
+
+            if (!moved->load(dbValue.toULongLong(), false) || !metaProperty.write(this, QVariant::fromValue(moved))) {
+                qWarning() << QString(R"(Could not refresh related Model "%1")").arg(name);
+                delete moved;
+                return false;
             }
+
+            continue;
         }
 
-        if (!metaProperty.write(this, dbValue) && eagerLoad) {
-            qWarning() << QString(R"(Could not set property "%1")").arg(metaProperty.name());
+        bool decoded = true;
+        QVariant value = propertyValue(metaProperty, dbValue, &decoded);
+        QVariant converted = value;
+
+        if (!decoded)
+            return false;
+
+        // Only the properties that actually changed are written, so only they notify
+        if (converted.convert(metaProperty.metaType()) && converted == metaProperty.read(this))
+            continue;
+
+        if (!metaProperty.write(this, value)) {
+            qWarning() << QString(R"(Could not set property "%1")").arg(name);
             return false;
         }
+
+        // The setter marks the property modified, but it now matches the database
+        m_modifiedProperties.remove(name);
     }
 
+    if (!classInfo("version").isNull())
+        m_version = column("row_version");
+
     return true;
 }
 
-bool Model::loadRelated(const QString& propertyName, bool eagerLoad)
+QList<Model::CounterCache> Model::counterCaches() const
 {
-    QString idPropName = QString("%1Id").arg(propertyName);
+    QList<CounterCache> caches;
 
-    if (!dynamicPropertyNames().contains(idPropName.toUtf8()))
-        return false;
+    for (int i = metaObject()->classInfoOffset(); i < metaObject()->classInfoCount(); ++i) {
+        QString name = metaObject()->classInfo(i).name();
+        QString value = metaObject()->classInfo(i).value();
 
-    model_id_t relatedId = property(idPropName.toLocal8Bit()).toUInt();
-    int relatedPropertyIndex = metaObject()->indexOfProperty(propertyName.toLocal8Bit());
-    QMetaProperty relatedMetaProperty = metaObject()->property(relatedPropertyIndex);
-    Model* related = createRelatedInstance(relatedMetaProperty);
+        if (name.startsWith("counterCache:")) {
+            caches << CounterCache{name.section(':', 1), value, QString()};
+        } else if (name.startsWith("sumCache:")) {
+            for (const QString& sum : value.split(',', Qt::SkipEmptyParts))
+                caches << CounterCache{name.section(':', 1), sum.section('=', 0, 0).trimmed(), sum.section('=', 1).trimmed()};
+        }
+    }
 
-    if (!related->load(relatedId, eagerLoad))
-        return false;
+    return caches;
+}
+
+QList<Model::CounterCache> Model::modifiedCounterCaches() const
+{
+    QList<CounterCache> caches;
+
+    // Only the caches whose foreign key or summed property changed need maintenance
+    for (const CounterCache& cache : counterCaches()) {
+        if (modifiedProperties().contains(cache.relation) || modifiedProperties().contains(cache.summed))
+            caches << cache;
+    }
+
+    return caches;
+}
+
+QVariantHash Model::storedValues(const QList<CounterCache>& caches) const
+{
+    QStringList columns;
+    QVariantHash values;
+
+    for (const CounterCache& cache : caches) {
+        columns << cache.relation;
+
+        if (!cache.summed.isEmpty())
+            columns << cache.summed;
+    }
+
+    columns.removeDuplicates();
+    QSqlQuery query;
+
+    if (!query.prepare(QString("SELECT %1 FROM %2 WHERE id = :id").arg(columns.join(','), tableName()))) {
+        qCritical() << "Could not prepare SELECT query:" << query.lastError().text();
+        return values;
+    }
+
+    query.bindValue(":id", id());
+
+    if (!query.exec() || !query.first())
+        return values;
+
+    for (const QString& column : std::as_const(columns))
+        values.insert(column, query.value(column));
+
+    return values;
+}
+
+bool Model::applyCounterCaches(const QList<CounterCache>& caches, const QVariantHash& before, const QVariantHash& after)
+{
+    for (const CounterCache& cache : caches) {
+        QMetaProperty relation = metaObject()->property(metaObject()->indexOfProperty(cache.relation.toLocal8Bit()));
+
+        if (!isPropertyModel(relation)) {
+            qWarning() << QString(R"(Counter cache relation "%1" is not a related Model)").arg(cache.relation);
+            continue;
+        }
+
+        // A counter counts each row as 1, a sum adds up the summed column
+        auto amount = [&cache](const QVariantHash& row) {
+            return row.isEmpty() ? 0.0 : cache.summed.isEmpty() ? 1.0 : row.value(cache.summed).toDouble();
+        };
+
+        QVariant oldParent = before.value(cache.relation);
+        QVariant newParent = after.value(cache.relation);
+        QList<QPair<QVariant, double>> deltas;
+
+        if (!oldParent.isNull() && oldParent == newParent) {
+            deltas << qMakePair(oldParent, amount(after) - amount(before));
+        } else {
+            deltas << qMakePair(oldParent, -amount(before));
+            deltas << qMakePair(newParent, amount(after));
+        }
+
+        std::unique_ptr<Model> parent(createRelatedInstance(relation));
+        QSqlQuery query;
+        QString queryStr = QString("UPDATE %1 SET %2 = COALESCE(%2, 0) + :delta WHERE id = :id").arg(parent->tableName(), cache.column);
+
+        if (!query.prepare(queryStr)) {
+            qCritical() << "Could not prepare counter cache UPDATE query:" << query.lastError().text();
+            return false;
+        }
+
+        for (const auto& delta : std::as_const(deltas)) {
+            if (delta.first.isNull() || delta.second == 0)
+                continue;
+
+            bool integral = cache.summed.isEmpty() || before.value(cache.summed).typeId() == QMetaType::LongLong
+                            || after.value(cache.summed).typeId() == QMetaType::LongLong;
+            query.bindValue(":delta", integral ? QVariant(qRound64(delta.second)) : QVariant(delta.second));
+            query.bindValue(":id", delta.first);
+
+            if (!query.exec()) {
+                qCritical() << "Could not update counter cache:" << query.lastError().text();
+                return false;
+            }
+
+            invalidateSharedRow(parent->tableName(), delta.first.toULongLong());
+            SqliteMaintenance::recordWrite(parent->tableName(), 1);
+        }
+
+        invalidateQueries(parent->tableName());
+    }
 
-    relatedMetaProperty.write(this, QVariant::fromValue(related));
     return true;
 }
 
-bool Model::isPropertyModel(const QMetaProperty& metaProperty)
+void Model::invalidateSharedRow(const QString& table, model_id_t id)
 {
-    auto metaObject = metaProperty.metaType().metaObject();
-    return metaObject != nullptr && metaObject->inherits(&staticMetaObject);
+    SharedRowCache::remove(table, id);
+
+    if (SharedRowCache::isAttached())
+        ScopedTransaction::afterEnd([table, id]() { SharedRowCache::remove(table, id); });
 }
 
-void Model::setId(model_id_t id)
+void Model::invalidateQueries(const QString& table)
 {
-    if (id == m_id)
-        return;
+    QueryCache::invalidate(table);
 
-    m_id = id;
-    emit idChanged();
+    if (QueryCache::isEnabled())
+        ScopedTransaction::afterEnd([table]() { QueryCache::invalidate(table); });
 }
 
-void Model::setModified(const QString& propertyName)
+bool Model::inTransaction()
 {
-    m_modifiedProperties.insert(propertyName);
+    return ScopedTransaction::inProgress();
 }
 
-const QSet<const QString>& Model::modifiedProperties() const
+void Model::runDeferredInvalidations()
 {
-    return m_modifiedProperties;
+    // Checking runs them once no transaction is in progress
+    ScopedTransaction::inProgress();
 }
 
-QVariant Model::insertQuery() const
+QHash<QString, qint64> Model::internedBytes()
 {
-    QStringList queryStr;
-    queryStr << "INSERT INTO " << tableName() << " (";
+    return internPools().savedBytes();
+}
 
-    forEachProperty([&queryStr](auto metaProperty) {
-        queryStr << metaProperty.name() << ",";
-    });
+void Model::registerCodec(const QString& name, quint8 header,
+                          std::function<QByteArray (const QByteArray&)> compress,
+                          std::function<QByteArray (const QByteArray&)> decompress)
+{
+    if (header == 0) {
+        qWarning() << "The codec header 0 is reserved for uncompressed values";
+        return;
+    }
 
-    queryStr.removeLast(); // trailing comma
-    queryStr << ") VALUES (";
+    codecs().add(name, {header, compress, decompress});
+}
 
-    forEachProperty([&queryStr](auto metaProperty) {
-        queryStr << QString(":%1").arg(metaProperty.name()) << ",";
-    });
+QVariant Model::databaseValue(const QMetaProperty& metaProperty) const
+{
+    QVariant value = metaProperty.read(this);
 
-    queryStr.removeLast();
-    queryStr << ")";
-    QSqlQuery query;
+    if (!value.isNull() && isPropertyDictionary(metaProperty))
+        return dictionaries().code(dictionaryTable(metaProperty), value.toString());
 
-    if (!query.prepare(queryStr.join(""))) {
-        qCritical() << "Could not prepare INSERT query:" << query.lastError().text();
-        return QVariant();
+    QString compression = classInfo(QString("compress:%1").arg(metaProperty.name()));
+
+    if (!compression.isNull() && !value.isNull()) {
+        QByteArray bytes = value.typeId() == QMetaType::QByteArray ? value.toByteArray() : value.toString().toUtf8();
+        QString codecName = "zlib";
+        int threshold = defaultCompressionThreshold;
+        Codec codec;
+
+        // "<codec>:<threshold>", either part can be omitted
+        for (const QString& part : compression.split(':', Qt::SkipEmptyParts)) {
+            bool isNumber = false;
+            int number = part.toInt(&isNumber);
+
+            if (isNumber)
+                threshold = number;
+            else
+                codecName = part.trimmed();
+        }
+
+        if (!codecs().byName(codecName, codec)) {
+            qWarning() << QString(R"(Unknown codec "%1", storing "%2" uncompressed)").arg(codecName, metaProperty.name());
+            return bytes.prepend(char(0));
+        }
+
+        if (bytes.isEmpty() || bytes.size() < threshold)
+            return bytes.prepend(char(0));
+
+        return codec.compress(bytes).prepend(char(codec.header));
     }
 
-    forEachProperty([&query, this](auto metaProperty) {
-        query.bindValue(QString(":%1").arg(metaProperty.name()), metaProperty.read(this));
-    });
+    if (!isPropertyModel(metaProperty))
+        return value;
 
-    return QVariant::fromValue(query);
+    Model* related = value.value<Model*>();
+
+    if (related == nullptr || !related->isSaved())
+        return QVariant();
+
+    return qlonglong(related->id()); // The type drivers return for integer columns
 }
 
-QVariant Model::updateQuery() const
+QVariant Model::propertyValue(const QMetaProperty& metaProperty, const QVariant& dbValue, bool* ok) const
 {
-    QStringList queryStr;
-    queryStr << "UPDATE " << tableName() << " SET ";
+    if (ok != nullptr)
+        *ok = true;
 
-    for (const QString& propertyName : modifiedProperties())
-        queryStr << propertyName << QString(" = :%1,").arg(propertyName); // Don't put extra space at the end
+    if (!dbValue.isNull() && isPropertyDictionary(metaProperty))
+        return dictionaries().value(dictionaryTable(metaProperty), dbValue.toLongLong());
 
-    queryStr.last().chop(1); // remove trailing comma
-    queryStr << " WHERE id = :id";
-    QSqlQuery query;
+    QString interning = classInfo(QString("intern:%1").arg(metaProperty.name()));
 
-    if (!query.prepare(queryStr.join(""))) {
-        qCritical() << "Could not prepare UPDATE query:" << query.lastError().text();
-        return QVariant();
-    }
+    if (!interning.isNull() && dbValue.typeId() == QMetaType::QString)
+        return internPools().intern(tableName(), metaProperty.name(), dbValue.toString(), interning == "auto");
 
-    for (const QString& propertyName : modifiedProperties()) {
-        int propertyIndex = metaObject()->indexOfProperty(propertyName.toLocal8Bit());
-        QMetaProperty property = metaObject()->property(propertyIndex);
-        QVariant value = property.read(this);
-        QString paramName = QString(":%1").arg(propertyName);
+    if (dbValue.typeId() != QMetaType::QByteArray || classInfo(QString("compress:%1").arg(metaProperty.name())).isNull())
+        return dbValue;
 
-        if (value.canConvert<Model*>()) {
-            Model* model = value.value<Model*>();
+    QByteArray bytes = dbValue.toByteArray();
 
-            if (!model->isSaved() && !model->insert())
-                return QVariant();
-            else if (model->isModified() && !model->update())
-                return QVariant();
+    if (bytes.isEmpty())
+        return dbValue;
 
-            query.bindValue(paramName, model->id());
-        } else {
-            query.bindValue(paramName, value);
-        }
+    quint8 header = quint8(bytes.at(0));
+    bytes.remove(0, 1);
+    Codec codec;
+
+    if (header != 0 && !codecs().byHeader(header, codec)) {
+        qCritical() << QString(R"(Unknown codec header %1 in "%2")").arg(header).arg(metaProperty.name());
+
+        if (ok != nullptr)
+            *ok = false;
+
+        return QVariant();
     }
 
-    query.bindValue(":id", id());
-    return QVariant::fromValue(query);
-}
+    // Empty values are never compressed, so an empty result means the data is corrupt
+    if (header != 0 && (bytes = codec.decompress(bytes)).isEmpty()) {
+        qCritical() << QString(R"(Could not decompress "%1")").arg(metaProperty.name());
 
-QVariant Model::deleteQuery() const
-{
-    QString queryStr = QString("DELETE FROM %1 WHERE id = ?").arg(tableName());
-    QSqlQuery query;
+        if (ok != nullptr)
+            *ok = false;
 
-    if (!query.prepare(queryStr)) {
-        qCritical() << "Couldn't prepare DELETE query:" << query.lastError().text();
         return QVariant();
     }
 
-    query.addBindValue(m_id);
-    return QVariant::fromValue(query);
+    if (metaProperty.metaType().id() == QMetaType::QByteArray)
+        return bytes;
+
+    return QString::fromUtf8(bytes);
+}
+
+bool Model::isPropertyDictionary(const QMetaProperty& metaProperty) const
+{
+    // The side tables are SQL tables, so storages keep the plain values
+    return !classInfo(QString("dictionary:%1").arg(metaProperty.name())).isNull()
+           && ModelStorage::storage(metaObject()) == nullptr;
+}
+
+QString Model::dictionaryTable(const QMetaProperty& metaProperty) const
+{
+    QString table = classInfo(QString("dictionary:%1").arg(metaProperty.name()));
+    return table.isEmpty() ? QString("%1_%2_dict").arg(tableName(), metaProperty.name()) : table;
 }
 
 bool Model::execDML(const QVariant& variant)
@@ -252,6 +2107,9 @@ bool Model::execDML(const QVariant& variant)
         setId(query.lastInsertId().toUInt());
     }
 
+    invalidateQueries(tableName());
+    invalidateSharedRow(tableName(), id());
+    SqliteMaintenance::recordWrite(tableName(), query.numRowsAffected());
     return true;
 }
 
@@ -262,6 +2120,35 @@ Model* Model::createRelatedInstance(const QMetaProperty& relatedProperty) const
     return (Model*)relatedMetaObject->newInstance();
 }
 
+QString Model::classInfo(const QString& name) const
+{
+    int index = metaObject()->indexOfClassInfo(name.toLocal8Bit());
+    return index < 0 ? QString() : QString(metaObject()->classInfo(index).value());
+}
+
+Model* Model::fromRow(const QMetaObject& metaObject, const RowReader& column, bool eagerLoad)
+{
+    auto model = static_cast<Model*>(metaObject.newInstance());
+
+    if (model == nullptr) {
+        qCritical() << "Could not create an instance of" << metaObject.className();
+        return nullptr;
+    }
+
+    RowPlan rowPlan = model->planRow(eagerLoad, nullptr, false);
+
+    if (!model->readRow(column, QString(), rowPlan)) {
+        delete model;
+        return nullptr;
+    }
+
+    if (!model->classInfo("version").isNull())
+        model->m_version = column("row_version");
+
+    model->setId(column("id").toULongLong());
+    return model;
+}
+
 void Model::forEachProperty(std::function<void (const QMetaProperty&)> action) const
 {
     int start = metaObject()->propertyOffset();
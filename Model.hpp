@@ -1,11 +1,18 @@
 #pragma once
 
 #include <QSet>
+#include <QHash>
+#include <memory>
 #include <QObject>
+#include <QPointer>
+#include <QStringList>
+#include <QVariantHash>
 #include <functional>
 #include <QMetaProperty>
 #include "QtModelLibrary_global.hpp"
 
+class QSqlQuery;
+
 using model_id_t = quint64;
 
 /**
@@ -17,6 +24,29 @@ class QTMODELLIBRARY_EXPORT Model : public QObject
     Q_PROPERTY(model_id_t id READ id NOTIFY idChanged FINAL)
 
 public:
+    /**
+     * @brief How a related Model property is fetched when its owner is loaded.
+     *        A strategy can be forced per property with a class info hint, e.g.
+     *        Q_CLASSINFO("fetch:address", "join"). Valid hints are "join", "select",
+     *        "lazy" and "auto" (the default), which lets the planner decide based
+     *        on the related row width, how often the relation is set, and how often
+     *        it's loaded afterwards when left lazy.
+     */
+    enum class FetchStrategy {
+        Join,   ///< Fetched in the owner's SELECT through a LEFT JOIN.
+        Select, ///< Fetched with a separate SELECT by id.
+        Lazy    ///< Not fetched. The id is kept for loadRelated.
+    };
+    Q_ENUM(FetchStrategy)
+
+    /**
+     * @brief The first children of a parent Model and how many children it has.
+     */
+    struct Preview {
+        QList<Model*> children; ///< Owned by the caller
+        qint64 count{0};
+    };
+
     explicit Model(QObject* parent = nullptr);
 
     /**
@@ -66,6 +96,19 @@ public:
      */
     bool deleteFromDatabase(); // Wish I could only use "delete" :P
 
+    /**
+     * @brief Writes a detached Model, e.g. one deserialized from a request, to the
+     *        row with the given id without loading it first. Only the properties set
+     *        on this instance (its modified properties) are written, in a single
+     *        UPDATE. When a version is given and the Model declares a version column,
+     *        the row is only written if its version still matches (optimistic locking).
+     * @param id The database id of the row.
+     * @param version The value of the version column the changes are based on.
+     * @return true if the row was written, false if it doesn't exist, its version
+     *         moved, or there was nothing to write.
+     */
+    bool merge(model_id_t id, const QVariant& version = QVariant());
+
     /**
      * @brief Attempts to load the Model from the database with the given id.
      *        By default, this method attempts to eagerly load related Models.
@@ -81,6 +124,20 @@ public:
      */
     virtual bool load(model_id_t id, bool eagerLoad = true);
 
+    /**
+     * @brief Attempts to load the Model from the database with the given id, eager
+     *        loading only the related Models named by the fetch plan. Each entry of the
+     *        plan is a dot separated path of related Model properties, for example
+     *        "address.city" or "employer". Related Models that are not part of the plan
+     *        are left to be Lazy Loaded, just as if load was called with eagerLoad = false.
+     *        Fetch plans are compiled once per Model type and cached.
+     * @param id The database id of the Model.
+     * @param fetchPlan The relation paths to eager load.
+     * @return true if the Model and every related Model in the plan could be loaded
+     *         from the database, false otherwise.
+     */
+    bool loadWith(model_id_t id, const QStringList& fetchPlan);
+
     /**
      * @brief Attempts to load a related Model that was not eager loaded (Lazy Loading).
      * @param propertyName The name of the related property to load from the database.
@@ -90,6 +147,86 @@ public:
      */
     virtual bool loadRelated(const QString& propertyName, bool eagerLoad = true);
 
+    /**
+     * @brief Reloads the properties of this Model that changed in the database since
+     *        it was loaded. When the Model declares a version column, e.g. with
+     *        Q_CLASSINFO("version", "updated_at"), the row is only read again if its
+     *        version moved. Only the properties whose value actually changed are
+     *        written, so only their NOTIFY signals are emitted, and related Models are
+     *        kept as long as their foreign key didn't change. Modified properties keep
+     *        their local value. Models kept in a ModelStorage are read from it.
+     * @return true if the Model is up to date, false if it was deleted from the
+     *         database or couldn't be refreshed.
+     */
+    bool refresh();
+
+    /**
+     * @brief Refreshes many Models at once, with one query per Model type to check
+     *        the versions and one to read the stale rows. A type that fails doesn't
+     *        keep the others from being refreshed.
+     * @param models The Models to refresh. Unsaved Models are ignored.
+     * @return true if every Model is up to date, false otherwise.
+     */
+    static bool refresh(const QList<Model*>& models);
+
+    /**
+     * @brief Creates the SQLite FTS5 index of the searchable properties of this Model
+     *        type, declared with Q_CLASSINFO("searchable", "title,body"). The index is
+     *        an external-content table named "<table>_fts" that is kept in sync with
+     *        the Model table by triggers. Existing rows are indexed when the index is
+     *        created. Calling this method again does nothing.
+     * @return true if the index exists, false otherwise.
+     */
+    bool createSearchIndex() const;
+
+    /**
+     * @brief Searches the Models of this type whose searchable properties match the
+     *        given FTS5 query, which requires createSearchIndex.
+     * @param terms The FTS5 query, e.g. "erick OR cardozo".
+     * @param limit The maximum number of Models to return.
+     * @param eagerLoad Should the related Models of the found Models be loaded.
+     * @return The found Models, best ranked first. The caller owns them.
+     */
+    QList<Model*> search(const QString& terms, int limit = 50, bool eagerLoad = false) const;
+
+    /**
+     * @brief Finds the Models of this type that match a condition, ordered by id. The
+     *        ids of the result are kept in the QueryCache when it's enabled, so repeating
+     *        the query only reads the rows by primary key. Models kept in a
+     *        ModelStorage can only be found with a "<column> = ?" filter.
+     * @param filter An optional SQL condition with positional "?" placeholders.
+     * @param bindValues The values of the filter placeholders.
+     * @param eagerLoad Should the related Models of the found Models be loaded.
+     * @return The found Models. The caller owns them.
+     */
+    QList<Model*> find(const QString& filter = QString(), const QVariantList& bindValues = QVariantList(),
+                       bool eagerLoad = false) const;
+
+    /**
+     * @brief Loads the first Models of this type that reference each of the given
+     *        parents, along with the number of Models that reference each parent, in
+     *        a single query. For example, the first 3 people living at each address:
+     *        Person().preview("address", addressIds, 3, "fullName").
+     * @param relation The related Model property that references the parent.
+     * @param parentIds The ids of the parents.
+     * @param limit The maximum number of children loaded per parent.
+     * @param orderBy The SQL ordering of the children of each parent.
+     * @return The preview of every parent, keyed by parent id. Related Models of the
+     *         children are left to be lazy loaded.
+     */
+    QHash<model_id_t, Preview> preview(const QString& relation, const QList<model_id_t>& parentIds, int limit,
+                                       const QString& orderBy = "id") const;
+
+    /**
+     * @brief Checks whether a transaction is in progress on the default connection,
+     *        either one the Models opened or one of the application. Transactions the
+     *        application opens on SQLite are only seen by the native SQLite backend.
+     *        Plain QPSQL connections are asked with one query, unless a Model
+     *        operation of this thread already knows the answer.
+     * @return true if a transaction is in progress, false otherwise.
+     */
+    static bool inTransaction();
+
     /**
      * @brief Checks wheter a property is of type Model.
      * @param metaProperty The meta-property of the property to test.
@@ -98,6 +235,32 @@ public:
      */
     static bool isPropertyModel(const QMetaProperty& metaProperty);
 
+    /**
+     * @brief Reports the memory saved by interning the loaded values of the properties
+     *        declared with Q_CLASSINFO("intern:<property>", "always") or
+     *        Q_CLASSINFO("intern:<property>", "auto"). Interned properties share one
+     *        string buffer per distinct value. In "auto" mode, a property stops being
+     *        interned if most of its first sampled values are distinct.
+     * @return The bytes saved by interning, by table name.
+     */
+    static QHash<QString, qint64> internedBytes();
+
+    /**
+     * @brief Registers a compression codec for the properties declared compressed
+     *        with Q_CLASSINFO("compress:<property>", "<codec>:<threshold>"). The
+     *        built-in "zlib" codec (qCompress) has header 1 and is the default codec.
+     *        The threshold, in bytes, defaults to 512: smaller values are stored
+     *        uncompressed. Compressed properties are stored in BLOB columns.
+     * @param name The name of the codec in the class info.
+     * @param header The byte stored before the compressed values to identify the
+     *        codec when decompressing. 0 is reserved for uncompressed values.
+     * @param compress Compresses a value.
+     * @param decompress Decompresses a value.
+     */
+    static void registerCodec(const QString& name, quint8 header,
+                              std::function<QByteArray (const QByteArray&)> compress,
+                              std::function<QByteArray (const QByteArray&)> decompress);
+
 signals:
     void idChanged();
 
@@ -143,10 +306,122 @@ protected:
      */
     virtual QVariant deleteQuery() const;
 
+    /**
+     * @brief Prepares the update query, matching the version column against the
+     *        expected version when it's valid and a version column is declared.
+     */
+    QVariant versionedUpdateQuery(const QVariant& expectedVersion) const;
+
 
 private:
-    model_id_t m_id;
+    friend class ModelCursor;
+    friend class ModelReader;
+    friend class PostgresBackend;
+    friend class PostgresPipeline;
+
+    /**
+     * @brief A compiled fetch plan: maps the name of each related Model property
+     *        to eager load to the remaining paths to load on that related Model.
+     */
+    using FetchPlan = QHash<QString, QStringList>;
+
+    /**
+     * @brief Reads the value of a column, by name, from the current row.
+     */
+    using RowReader = std::function<QVariant (const QString& column)>;
+
+    /**
+     * @brief The Models loaded together by one query or cursor page. Their lazy
+     *        relations are resolved together by loadRelated.
+     */
+    using SiblingGroup = QList<QPointer<Model>>;
+
+    /**
+     * @brief The fetch strategy chosen for each related Model property of a row
+     *        and the instances that are fetched through a JOIN.
+     */
+    struct RowPlan {
+        bool eagerLoad;
+        const FetchPlan* fetchPlan;
+        QHash<QString, FetchStrategy> strategies;
+        QHash<QString, Model*> joined;
+    };
+
+    model_id_t m_id{0};
     QSet<const QString> m_modifiedProperties;
+    QVariant m_version; ///< The value of the version column when last loaded
+    std::shared_ptr<SiblingGroup> m_siblings;
+
+    /**
+     * @brief Loads the Model row with the given id and assigns its properties.
+     * @param id The database id of the Model.
+     * @param eagerLoad Should related Models be loaded. Ignored when a plan is given.
+     * @param plan The compiled fetch plan, or nullptr to load all or nothing.
+     * @return true if the Model could be loaded, false otherwise.
+     */
+    bool loadRow(model_id_t id, bool eagerLoad, const FetchPlan* plan);
+
+    /**
+     * @brief Compiles the given relation paths against this Model type. Compiled
+     *        plans are cached per (type, plan) pair.
+     * @param paths The dot separated relation paths.
+     * @return The compiled fetch plan.
+     */
+    FetchPlan compileFetchPlan(const QStringList& paths) const;
+
+    /**
+     * @brief Chooses the fetch strategy of every related Model property of this
+     *        Model type. The chosen strategies are logged whenever they change.
+     * @param eagerLoad Should related Models be loaded. Ignored when a plan is given.
+     * @param plan The compiled fetch plan, or nullptr to load all or nothing.
+     * @param allowJoin Whether related Models may be joined. Only the top level row
+     *        joins, so nested relations never multiply the width of the result.
+     * @return The plan of the row.
+     */
+    RowPlan planRow(bool eagerLoad, const FetchPlan* plan, bool allowJoin) const;
+
+    /**
+     * @brief Plans the row of a related Model joined by a plan of this Model type.
+     * @param rowPlan The plan of this Model's row.
+     * @param relation The joined related Model property.
+     * @param relatedPlan Receives the fetch plan of the joined Model, which the
+     *        returned plan points to.
+     * @return The plan of the joined row.
+     */
+    RowPlan planJoinedRow(const RowPlan& rowPlan, const QString& relation, FetchPlan& relatedPlan) const;
+
+    /**
+     * @brief Checks whether reading a row of the plan loads related Models with a
+     *        SELECT of their own, including the relations of the joined Models.
+     */
+    bool selectsRelated(const RowPlan& rowPlan) const;
+
+    /**
+     * @brief Assigns the properties of this Model from the current row of a result.
+     * @param column Reads the columns of the row to read.
+     * @param prefix The prefix of the column aliases of this Model in the row.
+     * @param rowPlan The plan returned by planRow for this row. Its joined instances
+     *        are either assigned to their property or deleted.
+     * @return true if every property could be assigned, false otherwise. The Model
+     *         isn't modified after a successful read.
+     */
+    bool readRow(const RowReader& column, const QString& prefix, const RowPlan& rowPlan);
+
+    /**
+     * @brief Reads the value of the class info with the given name.
+     * @param name The name of the Q_CLASSINFO.
+     * @return The class info value or a null string if it's not declared.
+     */
+    QString classInfo(const QString& name) const;
+
+    /**
+     * @brief Creates a Model of the given type from a row of a result.
+     * @param metaObject The meta-object of the Model subclass.
+     * @param column Reads the columns of the row, which must include the id.
+     * @param eagerLoad Should related Models be loaded.
+     * @return A new Model owned by the caller, or nullptr on failure.
+     */
+    static Model* fromRow(const QMetaObject& metaObject, const RowReader& column, bool eagerLoad);
 
     /**
      * @brief Attempts to create an instance of a subclass of Model for a related property.
@@ -155,6 +430,156 @@ private:
      */
     Model* createRelatedInstance(const QMetaProperty& relatedProperty) const;
 
+    /**
+     * @brief A column of the parent Model kept up to date by the children. Declared
+     *        on the child class with Q_CLASSINFO("counterCache:<relation>", "<column>")
+     *        to count the children, or with
+     *        Q_CLASSINFO("sumCache:<relation>", "<column>=<summed property>[, ...]")
+     *        to add up a property of the children.
+     */
+    struct CounterCache {
+        QString relation;
+        QString column;
+        QString summed; ///< Empty for counters
+    };
+
+    QList<CounterCache> counterCaches() const;
+
+    /**
+     * @brief The counter caches whose relation or summed property was modified.
+     */
+    QList<CounterCache> modifiedCounterCaches() const;
+
+    /**
+     * @brief Executes a SELECT of the given columns of the rows with the given ids.
+     *        Large id sets are bound as a single parameter, joined with json_each on
+     *        SQLite and compared with = ANY on PostgreSQL, instead of one placeholder
+     *        per id.
+     * @return The executed query, which is not active on error.
+     */
+    QSqlQuery selectByIds(const QString& columns, const QList<model_id_t>& ids) const;
+
+    /**
+     * @brief Builds the condition that matches a column against a set of ids, as used
+     *        by selectByIds.
+     * @param column The column to match.
+     * @param ids The ids to match.
+     * @param bindValues Receives the values to bind to the condition placeholders.
+     * @return The SQL condition.
+     */
+    static QString idSetCondition(const QString& column, const QList<model_id_t>& ids, QVariantList& bindValues);
+
+    /**
+     * @brief Adds a Model to a group of siblings, creating the group if needed.
+     */
+    static void addSibling(std::shared_ptr<SiblingGroup>& group, Model* model);
+
+    /**
+     * @brief Makes the given Models siblings of each other.
+     */
+    static void makeSiblings(const QList<Model*>& models);
+
+    /**
+     * @brief Collects this Model and the siblings whose related property is still to
+     *        be lazy loaded, up to the batch size of the relation. The batch size is
+     *        declared with Q_CLASSINFO("batchSize:<relation>", "<size>") and defaults
+     *        to 50. A batch size of 1 disables batching.
+     * @param relation The meta-property of the related Model property.
+     * @return The Models to load the relation for, this Model first.
+     */
+    QList<Model*> pendingSiblings(const QMetaProperty& relation);
+
+    /**
+     * @brief Loads a related Model property of many Models with a single SELECT.
+     * @param models The Models whose relation is loaded.
+     * @param relation The meta-property of the related Model property.
+     * @param eagerLoad Should the related Models of the loaded Models be loaded.
+     * @return true if the query could be executed, false otherwise.
+     */
+    static bool loadRelatedBatch(const QList<Model*>& models, const QMetaProperty& relation, bool eagerLoad);
+
+    /**
+     * @brief Runs a query that returns whole rows of this Model table, or reads the
+     *        rows by primary key when the QueryCache holds the ids of its result.
+     * @param queryStr The query, which must select the id and every property column.
+     * @param bindValues The values of the positional placeholders.
+     * @param tables The tables the result depends on.
+     * @param eagerLoad Should related Models be loaded.
+     * @return The Models in the order of the result. The caller owns them.
+     */
+    QList<Model*> cachedQuery(const QString& queryStr, const QVariantList& bindValues, const QStringList& tables,
+                              bool eagerLoad) const;
+
+    /**
+     * @brief Writes the values of a refreshed row to the properties that changed,
+     *        skipping the modified ones.
+     * @param column Reads the columns of the row.
+     * @return true if every changed property could be written, false otherwise.
+     */
+    bool applyRow(const RowReader& column);
+
+    /**
+     * @brief Reads the current database values of the columns used by the caches.
+     * @return The values keyed by column, or an empty hash if the row doesn't exist.
+     */
+    QVariantHash storedValues(const QList<CounterCache>& caches) const;
+
+    /**
+     * @brief Updates the parent columns of the caches by the difference between the
+     *        child row before and after a write. Rows are empty when they don't exist.
+     * @return true if every cache could be updated, false otherwise.
+     */
+    bool applyCounterCaches(const QList<CounterCache>& caches, const QVariantHash& before, const QVariantHash& after);
+
+    /**
+     * @brief Invalidates the shared cached row right away and again once the
+     *        transaction in progress ends, since other processes may cache the row as
+     *        it was before the write until it's committed.
+     */
+    static void invalidateSharedRow(const QString& table, model_id_t id);
+
+    /**
+     * @brief Invalidates the cached queries of a table right away and again once the
+     *        transaction in progress ends, since other threads may cache results read
+     *        before the write until it's committed.
+     */
+    static void invalidateQueries(const QString& table);
+
+    /**
+     * @brief Applies the invalidations deferred until the application's transaction
+     *        ends, once it has ended.
+     */
+    static void runDeferredInvalidations();
+
+    /**
+     * @brief Converts the value of a property to the value stored in the database.
+     *        Related Models are stored as their id, or NULL if they are not saved.
+     *        Dictionary encoded properties are stored as their dictionary code.
+     *        Compressed properties are stored as a codec header byte and the value.
+     * @param metaProperty The meta-property of the property to convert.
+     * @return The database value of the property.
+     */
+    QVariant databaseValue(const QMetaProperty& metaProperty) const;
+
+    /**
+     * @brief Converts a database value to the value of a property, reversing the
+     *        conversions of databaseValue.
+     * @param metaProperty The meta-property of the property.
+     * @param dbValue The value read from the database.
+     * @param ok Set to false when a compressed value can't be decompressed.
+     * @return The value to assign to the property, or an invalid QVariant on failure.
+     */
+    QVariant propertyValue(const QMetaProperty& metaProperty, const QVariant& dbValue, bool* ok = nullptr) const;
+
+    /**
+     * @brief Checks whether a property is dictionary encoded, which is declared with
+     *        Q_CLASSINFO("dictionary:<property>", "") or with the name of the side
+     *        table as value. The Model table then stores integer codes, and the side
+     *        table (by default "<table>_<property>_dict") stores the distinct values.
+     */
+    bool isPropertyDictionary(const QMetaProperty& metaProperty) const;
+    QString dictionaryTable(const QMetaProperty& metaProperty) const;
+
     bool execDML(const QVariant& variant);
     void forEachProperty(std::function<void (const QMetaProperty&)> action) const;
 };
@@ -0,0 +1,176 @@
+#include <atomic>
+#include <memory>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlField>
+#include <QSqlDriver>
+#include <QSqlDatabase>
+#include "ModelCursor.hpp"
+
+ModelCursor::ModelCursor(const QMetaObject& metaObject, const QString& filter,
+                         const QVariantList& bindValues, int fetchSize)
+    : m_metaObject{&metaObject}
+    , m_filter{filter}
+    , m_bindValues{bindValues}
+    , m_fetchSize{qMax(1, fetchSize)}
+{
+}
+
+ModelCursor::~ModelCursor()
+{
+    close();
+}
+
+bool ModelCursor::open()
+{
+    static std::atomic_uint cursorCount{0};
+    close();
+
+    std::unique_ptr<Model> prototype(static_cast<Model*>(m_metaObject->newInstance()));
+
+    if (!prototype) {
+        qCritical() << "Could not create an instance of" << m_metaObject->className();
+        return false;
+    }
+
+    QStringList queryStr;
+    queryStr << "SELECT id,";
+
+    prototype->forEachProperty([&queryStr](auto metaProperty) {
+        queryStr << metaProperty.name() << ",";
+    });
+
+    queryStr.removeLast(); // trailing comma
+
+    if (QString versionColumn = prototype->classInfo("version"); !versionColumn.isNull())
+        queryStr << ", " << versionColumn << " AS row_version";
+
+    queryStr << " FROM " << prototype->tableName();
+
+    if (!m_filter.isEmpty())
+        queryStr << " WHERE " << m_filter;
+
+    queryStr << " ORDER BY id";
+    QSqlDatabase database = QSqlDatabase::database();
+    m_query = std::make_unique<QSqlQuery>(database);
+    m_query->setForwardOnly(true);
+
+    if (database.driverName() != "QPSQL") {
+        if (!m_query->prepare(queryStr.join(""))) {
+            qCritical() << "Could not prepare SELECT query:" << m_query->lastError().text();
+            return false;
+        }
+
+        for (const QVariant& value : m_bindValues)
+            m_query->addBindValue(value);
+
+        if (!m_query->exec()) {
+            qCritical() << "Could not execute SELECT query:" << m_query->lastError().text();
+            return false;
+        }
+
+        m_isOpen = true;
+        m_isLastPage = true;
+        return true;
+    }
+
+    // DECLARE can't be a prepared statement, so the driver formats the values inline
+    QString select = queryStr.join("");
+    qsizetype placeholder = 0;
+
+    for (const QVariant& value : m_bindValues) {
+        placeholder = select.indexOf('?', placeholder);
+
+        if (placeholder < 0) {
+            qCritical() << "The cursor filter has less placeholders than bind values";
+            return false;
+        }
+
+        QSqlField field(QString(), value.metaType());
+        field.setValue(value);
+        QString literal = database.driver()->formatValue(field);
+        select.replace(placeholder, 1, literal);
+        placeholder += literal.size();
+    }
+
+    // A cursor only lives within a transaction, the application's one if it has one
+    m_ownsTransaction = !Model::inTransaction();
+
+    if (m_ownsTransaction && !database.transaction()) {
+        qCritical() << "Could not begin the cursor transaction:" << database.lastError().text();
+        return false;
+    }
+
+    m_cursorName = QString("model_cursor_%1").arg(++cursorCount);
+
+    if (!m_query->exec(QString("DECLARE %1 NO SCROLL CURSOR FOR %2").arg(m_cursorName, select))) {
+        qCritical() << "Could not declare cursor:" << m_query->lastError().text();
+        m_cursorName.clear();
+
+        // A failed statement aborts the application's transaction, which is left to it
+        if (m_ownsTransaction)
+            database.rollback();
+
+        return false;
+    }
+
+    m_isOpen = true;
+    return fetchPage();
+}
+
+Model* ModelCursor::next(bool eagerLoad)
+{
+    if (!m_isOpen)
+        return nullptr;
+
+    if (!m_query->next() && (m_isLastPage || !fetchPage() || !m_query->next())) {
+        close();
+        return nullptr;
+    }
+
+    Model* model = Model::fromRow(*m_metaObject, [this](const QString& column) { return m_query->value(column); }, eagerLoad);
+
+    if (model == nullptr)
+        return nullptr;
+
+    if (m_siblings && m_siblings->size() >= m_fetchSize)
+        m_siblings.reset();
+
+    Model::addSibling(m_siblings, model);
+    return model;
+}
+
+void ModelCursor::close()
+{
+    if (!m_isOpen)
+        return;
+
+    m_query->finish();
+    m_isOpen = false;
+    m_siblings.reset();
+
+    if (m_cursorName.isEmpty())
+        return;
+
+    QSqlDatabase database = QSqlDatabase::database();
+    QSqlQuery closeQuery(database);
+
+    if (!closeQuery.exec(QString("CLOSE %1").arg(m_cursorName)))
+        qWarning() << "Could not close cursor:" << closeQuery.lastError().text();
+
+    if (m_ownsTransaction && !database.commit())
+        qWarning() << "Could not end the cursor transaction:" << database.lastError().text();
+
+    m_cursorName.clear();
+}
+
+bool ModelCursor::fetchPage()
+{
+    if (!m_query->exec(QString("FETCH FORWARD %1 FROM %2").arg(m_fetchSize).arg(m_cursorName))) {
+        qCritical() << "Could not fetch from cursor:" << m_query->lastError().text();
+        return false;
+    }
+
+    m_isLastPage = m_query->size() < m_fetchSize;
+    return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <memory>
+#include <QVariantList>
+#include "Model.hpp"
+
+class QSqlQuery;
+
+/**
+ * @brief Streams the Models of a table without loading the whole result in memory.
+ *        On PostgreSQL, whose driver buffers complete result sets on the client, the
+ *        rows are read through a server-side cursor (DECLARE CURSOR / FETCH) inside a
+ *        transaction, fetchSize rows at a time. The cursor uses the transaction of the
+ *        application when one is in progress, and its own otherwise. Other drivers use
+ *        a forward-only query.
+ *
+ * @code
+ * ModelCursor cursor(Person::staticMetaObject, "birth >= ?", {QDate(2000, 1, 1)});
+ *
+ * if (cursor.open()) {
+ *     while (Model* person = cursor.next()) {
+ *         // ...
+ *         delete person;
+ *     }
+ * }
+ * @endcode
+ */
+class QTMODELLIBRARY_EXPORT ModelCursor
+{
+public:
+    /**
+     * @brief Creates a cursor over the Models of the given type.
+     * @param metaObject The meta-object of the Model subclass to stream.
+     * @param filter An optional SQL condition with positional "?" placeholders.
+     *        On PostgreSQL the values are inlined in the DECLARE statement by the
+     *        driver, so placeholders must not appear inside string literals.
+     * @param bindValues The values of the filter placeholders.
+     * @param fetchSize How many rows are fetched from a server-side cursor at a time.
+     */
+    explicit ModelCursor(const QMetaObject& metaObject, const QString& filter = QString(),
+                         const QVariantList& bindValues = QVariantList(), int fetchSize = 1000);
+    ~ModelCursor();
+
+    /**
+     * @brief Executes the query of the cursor. Any previous result is closed.
+     * @return true if the query could be executed, false otherwise.
+     */
+    bool open();
+
+    /**
+     * @brief Reads the next Model of the result. Related Models are loaded as with
+     *        Model::load. The Models of each page of fetchSize rows are siblings: lazy
+     *        loading a relation of one loads it for the whole page with one query.
+     * @param eagerLoad Should the related Models be loaded.
+     * @return A new Model owned by the caller, or nullptr at the end of the result
+     *         or on error.
+     */
+    Model* next(bool eagerLoad = false);
+
+    /**
+     * @brief Releases the result and, on PostgreSQL, closes the server-side cursor
+     *        and ends the transaction it started, if any. Called automatically at the
+     *        end of the result.
+     */
+    void close();
+
+private:
+    Q_DISABLE_COPY(ModelCursor)
+
+    const QMetaObject* m_metaObject;
+    QString m_filter;
+    QVariantList m_bindValues;
+    int m_fetchSize;
+    std::unique_ptr<QSqlQuery> m_query;
+    QString m_cursorName;
+    bool m_ownsTransaction{false};
+    bool m_isOpen{false};
+    bool m_isLastPage{true};
+    std::shared_ptr<Model::SiblingGroup> m_siblings; ///< The Models of the current page
+
+    bool fetchPage();
+};
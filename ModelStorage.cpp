@@ -0,0 +1,25 @@
+#include <QMutex>
+#include "ModelStorage.hpp"
+
+namespace {
+
+QMutex storagesMutex;
+QHash<const QMetaObject*, ModelStorage*> storages;
+
+}
+
+void ModelStorage::setStorage(const QMetaObject& metaObject, ModelStorage* storage)
+{
+    QMutexLocker locker(&storagesMutex);
+
+    if (storage == nullptr)
+        storages.remove(&metaObject);
+    else
+        storages.insert(&metaObject, storage);
+}
+
+ModelStorage* ModelStorage::storage(const QMetaObject* metaObject)
+{
+    QMutexLocker locker(&storagesMutex);
+    return storages.value(metaObject);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <QList>
+#include <QVariantHash>
+#include "Model.hpp"
+
+/**
+ * @brief A storage engine that can persist Models instead of the default QtSql
+ *        database. Rows are exchanged as column values keyed by column name, using
+ *        the same values Model binds to its SQL queries. A storage is selected per
+ *        Model type with setStorage; types without a storage keep using QtSql.
+ *
+ *        Models stored in a ModelStorage don't use the insertQuery, updateQuery and
+ *        deleteQuery hooks.
+ */
+class QTMODELLIBRARY_EXPORT ModelStorage
+{
+public:
+    virtual ~ModelStorage() = default;
+
+    /**
+     * @brief Inserts a row and generates its id.
+     * @param table The table of the row.
+     * @param row The column values of the row, without the id.
+     * @param id Receives the id of the inserted row.
+     * @return true if the row was inserted, false otherwise.
+     */
+    virtual bool insert(const QString& table, const QVariantHash& row, model_id_t& id) = 0;
+
+    /**
+     * @brief Updates some columns of a row.
+     * @param table The table of the row.
+     * @param id The id of the row.
+     * @param values The new values of the updated columns.
+     * @return true if the row exists and was updated, false otherwise.
+     */
+    virtual bool update(const QString& table, model_id_t id, const QVariantHash& values) = 0;
+
+    /**
+     * @brief Deletes a row.
+     * @return true if the row existed and was deleted, false otherwise.
+     */
+    virtual bool remove(const QString& table, model_id_t id) = 0;
+
+    /**
+     * @brief Reads a row.
+     * @param table The table of the row.
+     * @param id The id of the row.
+     * @param row Receives the column values of the row.
+     * @return true if the row exists, false otherwise.
+     */
+    virtual bool load(const QString& table, model_id_t id, QVariantHash& row) const = 0;
+
+    /**
+     * @brief Finds the rows of a table whose column is equal to the given value.
+     * @return The ids of the matching rows, in ascending order.
+     */
+    virtual QList<model_id_t> query(const QString& table, const QString& column, const QVariant& value) const = 0;
+
+    /**
+     * @brief Selects the storage of a Model type.
+     * @param metaObject The meta-object of the Model subclass.
+     * @param storage The storage to use, which must outlive its use, or nullptr to
+     *        use the default QtSql database again.
+     */
+    static void setStorage(const QMetaObject& metaObject, ModelStorage* storage);
+
+    /**
+     * @brief The storage selected for a Model type.
+     * @return The storage or nullptr if the Model type uses the QtSql database.
+     */
+    static ModelStorage* storage(const QMetaObject* metaObject);
+};
@@ -0,0 +1,554 @@
+#include <cstring>
+#include <QDate>
+#include <QMutex>
+#include <QDateTime>
+#include <QDataStream>
+#include <QtEndian>
+#include "ModelStream.hpp"
+#include "Encoding.hpp"
+
+/**
+ * @brief The columns of a Model type as sent on the wire: the id, then every property
+ *        in declaration order.
+ */
+struct ModelStreamSchema {
+    enum Kind { Unsigned, Signed, Bool, Double, String, Bytes, Date, Time, DateTime, Related, Other };
+
+    struct Column {
+        QString name;
+        int propertyIndex; ///< -1 for the id
+        Kind kind;
+    };
+
+    const QMetaObject* metaObject;
+    QList<Column> columns;
+    QHash<QString, int> indexes;
+    quint64 hash;
+
+    static std::shared_ptr<const ModelStreamSchema> of(const QMetaObject& metaObject);
+};
+
+namespace {
+
+ModelStreamSchema::Kind kindOf(const QMetaProperty& metaProperty)
+{
+    QMetaType metaType = metaProperty.metaType();
+
+    if (Model::isPropertyModel(metaProperty))
+        return ModelStreamSchema::Related;
+
+    if (metaType.flags().testFlag(QMetaType::IsEnumeration))
+        return ModelStreamSchema::Signed;
+
+    switch (metaType.id()) {
+    case QMetaType::Bool:
+        return ModelStreamSchema::Bool;
+    case QMetaType::Char:
+    case QMetaType::SChar:
+    case QMetaType::Short:
+    case QMetaType::Int:
+    case QMetaType::Long:
+    case QMetaType::LongLong:
+        return ModelStreamSchema::Signed;
+    case QMetaType::UChar:
+    case QMetaType::UShort:
+    case QMetaType::UInt:
+    case QMetaType::ULong:
+    case QMetaType::ULongLong:
+        return ModelStreamSchema::Unsigned;
+    case QMetaType::Float:
+    case QMetaType::Double:
+        return ModelStreamSchema::Double;
+    case QMetaType::QString:
+        return ModelStreamSchema::String;
+    case QMetaType::QByteArray:
+        return ModelStreamSchema::Bytes;
+    case QMetaType::QDate:
+        return ModelStreamSchema::Date;
+    case QMetaType::QTime:
+        return ModelStreamSchema::Time;
+    case QMetaType::QDateTime:
+        return ModelStreamSchema::DateTime;
+    default:
+        return ModelStreamSchema::Other;
+    }
+}
+
+/**
+ * @brief Reads the values of a frame, checking every read against its end.
+ */
+struct Decoder
+{
+    const QByteArray& data;
+    qsizetype position;
+
+    bool varint(quint64& value)
+    {
+        value = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (position >= data.size())
+                return false;
+
+            auto byte = quint8(data.at(position++));
+            value |= quint64(byte & 0x7f) << shift;
+
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+
+        return false;
+    }
+
+    bool skip(quint64 size)
+    {
+        if (size > quint64(data.size() - position))
+            return false;
+
+        position += qsizetype(size);
+        return true;
+    }
+
+    bool skipValue(ModelStreamSchema::Kind kind)
+    {
+        quint64 value = 0;
+
+        switch (kind) {
+        case ModelStreamSchema::Bool:
+            return skip(1);
+        case ModelStreamSchema::Double:
+            return skip(8);
+        case ModelStreamSchema::Bytes:
+        case ModelStreamSchema::Other:
+            return varint(value) && skip(value);
+        default:
+            return varint(value);
+        }
+    }
+};
+
+}
+
+std::shared_ptr<const ModelStreamSchema> ModelStreamSchema::of(const QMetaObject& metaObject)
+{
+    static QMutex mutex;
+    static QHash<const QMetaObject*, std::shared_ptr<const ModelStreamSchema>> schemas;
+    QMutexLocker locker(&mutex);
+    std::shared_ptr<const ModelStreamSchema>& cached = schemas[&metaObject];
+
+    if (cached)
+        return cached;
+
+    auto schema = std::make_shared<ModelStreamSchema>();
+    schema->metaObject = &metaObject;
+    schema->columns << Column{"id", -1, Unsigned};
+    // The hash covers the names and types of the columns, a mismatch means another class version
+    QByteArray signature(metaObject.className());
+
+    for (int i = metaObject.propertyOffset(); i < metaObject.propertyCount(); ++i) {
+        QMetaProperty metaProperty = metaObject.property(i);
+        schema->columns << Column{metaProperty.name(), i, kindOf(metaProperty)};
+        signature.append(';').append(metaProperty.name()).append(':').append(metaProperty.typeName());
+    }
+
+    for (int i = 0; i < schema->columns.size(); ++i)
+        schema->indexes.insert(schema->columns.at(i).name, i);
+
+    schema->hash = Encoding::fnv1a(signature);
+
+    cached = schema;
+    return cached;
+}
+
+model_id_t ModelRowView::id() const
+{
+    if (m_offsets.isEmpty() || m_offsets.first() < 0)
+        return 0;
+
+    Decoder decoder{m_frame, m_offsets.first()};
+    quint64 id = 0;
+    return decoder.varint(id) ? id : 0;
+}
+
+bool ModelRowView::isNull(const QString& column) const
+{
+    return offsetOf(column) < 0;
+}
+
+QVariant ModelRowView::value(const QString& column) const
+{
+    int kind = ModelStreamSchema::Other;
+    qsizetype offset = offsetOf(column, &kind);
+
+    if (offset < 0)
+        return QVariant();
+
+    Decoder decoder{m_frame, offset};
+    quint64 value = 0;
+
+    switch (kind) {
+    case ModelStreamSchema::Bool:
+        return QVariant(m_frame.at(offset) != 0);
+    case ModelStreamSchema::Double: {
+        quint64 bits = qFromLittleEndian<quint64>(m_frame.constData() + offset);
+        double number = 0;
+        std::memcpy(&number, &bits, sizeof(number));
+        return number;
+    }
+    case ModelStreamSchema::String:
+        return QString::fromUtf8(utf8(column));
+    case ModelStreamSchema::Bytes:
+    case ModelStreamSchema::Other: {
+        decoder.varint(value);
+        QByteArray bytes = m_frame.mid(decoder.position, qsizetype(value));
+
+        if (kind == ModelStreamSchema::Bytes)
+            return bytes;
+
+        QDataStream in(bytes);
+        QVariant variant;
+        in >> variant;
+        return variant;
+    }
+    default:
+        decoder.varint(value);
+    }
+
+    switch (kind) {
+    case ModelStreamSchema::Signed:
+        return QVariant(qlonglong(Encoding::unzigzag(value)));
+    case ModelStreamSchema::Related:
+        return QVariant(qlonglong(value)); // Just like a foreign key read from the database
+    case ModelStreamSchema::Date:
+        return QDate::fromJulianDay(Encoding::unzigzag(value));
+    case ModelStreamSchema::Time:
+        return QTime::fromMSecsSinceStartOfDay(int(value));
+    case ModelStreamSchema::DateTime:
+        return QDateTime::fromMSecsSinceEpoch(Encoding::unzigzag(value));
+    default:
+        return QVariant(qulonglong(value));
+    }
+}
+
+QByteArrayView ModelRowView::utf8(const QString& column) const
+{
+    int kind = ModelStreamSchema::Other;
+    qsizetype offset = offsetOf(column, &kind);
+    quint64 index = 0;
+
+    if (offset < 0 || kind != ModelStreamSchema::String)
+        return QByteArrayView();
+
+    Decoder decoder{m_frame, offset};
+
+    if (!decoder.varint(index) || index >= quint64(m_strings.size()))
+        return QByteArrayView();
+
+    const auto& string = m_strings.at(qsizetype(index));
+    return QByteArrayView(m_frame.constData() + string.first, string.second);
+}
+
+qsizetype ModelRowView::offsetOf(const QString& column, int* kind) const
+{
+    int index = m_schema ? m_schema->indexes.value(column, -1) : -1;
+
+    if (index < 0 || index >= m_offsets.size())
+        return -1;
+
+    if (kind != nullptr)
+        *kind = m_schema->columns.at(index).kind;
+
+    return m_offsets.at(index);
+}
+
+ModelWriter::ModelWriter(QIODevice* device, int batchSize)
+    : m_device{device}
+    , m_batchSize{qMax(1, batchSize)}
+{
+}
+
+ModelWriter::~ModelWriter()
+{
+    flush();
+}
+
+bool ModelWriter::write(const Model* model)
+{
+    if (model == nullptr)
+        return false;
+
+    std::shared_ptr<const ModelStreamSchema> schema = ModelStreamSchema::of(*model->metaObject());
+
+    // A frame holds a single Model type
+    if (m_schema && m_schema != schema && !flush())
+        return false;
+
+    m_schema = schema;
+    const QList<ModelStreamSchema::Column>& columns = schema->columns;
+    QByteArray bitmap((columns.size() + 7) / 8, 0);
+    QByteArray values;
+
+    for (int i = 0; i < columns.size(); ++i) {
+        const ModelStreamSchema::Column& column = columns.at(i);
+        QVariant value = column.propertyIndex < 0 ? QVariant::fromValue(model->id())
+                                                  : model->metaObject()->property(column.propertyIndex).read(model);
+
+        if (column.kind == ModelStreamSchema::Related) {
+            auto related = value.value<Model*>();
+            model_id_t relatedId = related != nullptr ? related->id()
+                                                      : model->property(QString("%1Id").arg(column.name).toLocal8Bit()).toULongLong();
+            value = relatedId == 0 ? QVariant() : QVariant::fromValue(relatedId);
+        }
+
+        if (value.isNull())
+            continue;
+
+        qsizetype start = values.size();
+
+        switch (column.kind) {
+        case ModelStreamSchema::Bool:
+            values.append(char(value.toBool()));
+            break;
+        case ModelStreamSchema::Signed:
+            Encoding::putVarint(values, Encoding::zigzag(value.toLongLong()));
+            break;
+        case ModelStreamSchema::Double: {
+            double number = value.toDouble();
+            quint64 bits = 0;
+            std::memcpy(&bits, &number, sizeof(bits));
+            bits = qToLittleEndian(bits);
+            values.append(reinterpret_cast<const char*>(&bits), sizeof(bits));
+            break;
+        }
+        case ModelStreamSchema::String: {
+            QString string = value.toString();
+            auto index = m_stringIndexes.constFind(string);
+
+            if (index == m_stringIndexes.constEnd()) {
+                index = m_stringIndexes.insert(string, quint64(m_strings.size()));
+                m_strings << string.toUtf8();
+            }
+
+            Encoding::putVarint(values, index.value());
+            break;
+        }
+        case ModelStreamSchema::Bytes: {
+            QByteArray bytes = value.toByteArray();
+            Encoding::putVarint(values, quint64(bytes.size()));
+            values.append(bytes);
+            break;
+        }
+        case ModelStreamSchema::Date:
+            if (value.toDate().isValid())
+                Encoding::putVarint(values, Encoding::zigzag(value.toDate().toJulianDay()));
+            break;
+        case ModelStreamSchema::Time:
+            if (value.toTime().isValid())
+                Encoding::putVarint(values, quint64(value.toTime().msecsSinceStartOfDay()));
+            break;
+        case ModelStreamSchema::DateTime:
+            if (value.toDateTime().isValid())
+                Encoding::putVarint(values, Encoding::zigzag(value.toDateTime().toMSecsSinceEpoch()));
+            break;
+        case ModelStreamSchema::Other: {
+            QByteArray bytes;
+            QDataStream out(&bytes, QIODevice::WriteOnly);
+            out << value;
+            Encoding::putVarint(values, quint64(bytes.size()));
+            values.append(bytes);
+            break;
+        }
+        default:
+            Encoding::putVarint(values, value.toULongLong());
+        }
+
+        // Invalid dates and times are sent as NULL
+        if (values.size() > start)
+            bitmap[i / 8] = char(bitmap.at(i / 8) | (1 << (i % 8)));
+    }
+
+    m_rows.append(bitmap).append(values);
+
+    if (++m_rowCount >= m_batchSize)
+        return flush();
+
+    return true;
+}
+
+bool ModelWriter::flush()
+{
+    if (m_rowCount == 0)
+        return true;
+
+    QByteArray body;
+    quint64 hash = qToLittleEndian(m_schema->hash);
+    body.append(reinterpret_cast<const char*>(&hash), sizeof(hash));
+    Encoding::putVarint(body, quint64(m_rowCount));
+    Encoding::putVarint(body, quint64(m_strings.size()));
+
+    for (const QByteArray& string : std::as_const(m_strings)) {
+        Encoding::putVarint(body, quint64(string.size()));
+        body.append(string);
+    }
+
+    body.append(m_rows);
+    QByteArray frame;
+    Encoding::putVarint(frame, quint64(body.size()));
+    frame.append(body);
+    m_rows.clear();
+    m_rowCount = 0;
+    m_stringIndexes.clear();
+    m_strings.clear();
+
+    if (m_device->write(frame) != frame.size()) {
+        qCritical() << "Could not write Model frame:" << m_device->errorString();
+        return false;
+    }
+
+    return true;
+}
+
+ModelReader::ModelReader(QIODevice* device, const QMetaObject& metaObject)
+    : m_device{device}
+    , m_schema{ModelStreamSchema::of(metaObject)}
+{
+}
+
+bool ModelReader::nextRow(ModelRowView& row)
+{
+    while (!m_error && m_remainingRows == 0) {
+        if (!readFrame())
+            return false;
+    }
+
+    if (m_error)
+        return false;
+
+    const QList<ModelStreamSchema::Column>& columns = m_schema->columns;
+    Decoder decoder{m_frame, m_position};
+    qsizetype bitmap = m_position;
+
+    if (!decoder.skip(quint64(columns.size() + 7) / 8)) {
+        fail("Truncated Model row");
+        return false;
+    }
+
+    row.m_offsets.resize(columns.size());
+
+    for (int i = 0; i < columns.size(); ++i) {
+        if ((m_frame.at(bitmap + i / 8) & (1 << (i % 8))) == 0) {
+            row.m_offsets[i] = -1;
+            continue;
+        }
+
+        row.m_offsets[i] = decoder.position;
+
+        if (!decoder.skipValue(columns.at(i).kind)) {
+            fail("Truncated Model row");
+            return false;
+        }
+    }
+
+    m_position = decoder.position;
+    --m_remainingRows;
+    row.m_schema = m_schema;
+    row.m_frame = m_frame;
+    row.m_strings = m_strings;
+    return true;
+}
+
+Model* ModelReader::next()
+{
+    ModelRowView row;
+
+    if (!nextRow(row))
+        return nullptr;
+
+    auto model = static_cast<Model*>(m_schema->metaObject->newInstance());
+
+    if (model == nullptr) {
+        qCritical() << "Could not create an instance of" << m_schema->metaObject->className();
+        return nullptr;
+    }
+
+    for (const ModelStreamSchema::Column& column : m_schema->columns) {
+        if (column.propertyIndex < 0)
+            continue;
+
+        QVariant value = row.value(column.name);
+
+        if (!value.isValid())
+            continue;
+
+        // Kept for Lazy Loading, as if loaded with eagerLoad = false
+        if (column.kind == ModelStreamSchema::Related)
+            model->setProperty(QString("%1Id").arg(column.name).toLocal8Bit(), value);
+        else if (!m_schema->metaObject->property(column.propertyIndex).write(model, value))
+            qWarning() << QString(R"(Could not set property "%1")").arg(column.name);
+    }
+
+    model->setId(row.id());
+    return model;
+}
+
+bool ModelReader::hasError() const
+{
+    return m_error;
+}
+
+bool ModelReader::readFrame()
+{
+    m_buffer.append(m_device->readAll());
+    Decoder header{m_buffer, 0};
+    quint64 size = 0;
+
+    // Not even the size of the frame arrived yet
+    if (!header.varint(size) || size > quint64(m_buffer.size() - header.position))
+        return false;
+
+    m_frame = m_buffer.mid(header.position, qsizetype(size));
+    m_buffer.remove(0, header.position + qsizetype(size));
+
+    if (m_frame.size() < qsizetype(sizeof(quint64))) {
+        fail("Truncated Model frame");
+        return false;
+    }
+
+    if (qFromLittleEndian<quint64>(m_frame.constData()) != m_schema->hash) {
+        fail(QString("The stream wasn't written for this version of %1").arg(m_schema->metaObject->className()));
+        return false;
+    }
+
+    Decoder frame{m_frame, qsizetype(sizeof(quint64))};
+    quint64 rows = 0;
+    quint64 strings = 0;
+
+    if (!frame.varint(rows) || !frame.varint(strings)) {
+        fail("Truncated Model frame");
+        return false;
+    }
+
+    m_strings.clear();
+
+    for (quint64 i = 0; i < strings; ++i) {
+        quint64 length = 0;
+
+        if (!frame.varint(length) || !frame.skip(length)) {
+            fail("Truncated Model frame");
+            return false;
+        }
+
+        m_strings << qMakePair(frame.position - qsizetype(length), qsizetype(length));
+    }
+
+    m_position = frame.position;
+    m_remainingRows = rows;
+    return true;
+}
+
+void ModelReader::fail(const QString& message)
+{
+    qCritical().noquote() << message;
+    m_error = true;
+    m_remainingRows = 0;
+}
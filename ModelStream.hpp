@@ -0,0 +1,135 @@
+#pragma once
+
+#include <memory>
+#include <QIODevice>
+#include <QByteArrayView>
+#include <QVarLengthArray>
+#include "Model.hpp"
+
+struct ModelStreamSchema;
+
+/**
+ * @brief A row decoded by ModelReader. The values stay encoded in the frame they
+ *        were read from and are only decoded when asked for, so reading a few
+ *        columns of many rows copies nothing else.
+ */
+class QTMODELLIBRARY_EXPORT ModelRowView
+{
+public:
+    model_id_t id() const;
+    bool isNull(const QString& column) const;
+
+    /**
+     * @brief Decodes the value of a column. A related Model column holds the id of
+     *        the related Model.
+     * @return The value, or an invalid QVariant for NULL or unknown columns.
+     */
+    QVariant value(const QString& column) const;
+
+    /**
+     * @brief The UTF-8 bytes of a QString column, without decoding nor copying them.
+     *        The view is valid as long as this row.
+     */
+    QByteArrayView utf8(const QString& column) const;
+
+private:
+    friend class ModelReader;
+
+    std::shared_ptr<const ModelStreamSchema> m_schema;
+    QByteArray m_frame;
+    QList<QPair<qsizetype, qsizetype>> m_strings; ///< Offset and size of each string of the frame
+    QVarLengthArray<qsizetype, 16> m_offsets;     ///< Offset of each column value, -1 for NULL
+
+    qsizetype offsetOf(const QString& column, int* kind = nullptr) const;
+};
+
+/**
+ * @brief Writes Models to a QIODevice, e.g. a QLocalSocket, in a compact binary
+ *        format derived from their properties. Rows are sent in frames of up to
+ *        batchSize Models of the same type. Each frame starts with a hash of the
+ *        class mapping, so a reader built from a different version of the class
+ *        rejects it, followed by a table of the distinct strings of the frame and
+ *        the rows: a NULL bitmap and the values as varints, zigzag varints, fixed
+ *        size doubles and string table indexes. Related Models are sent as ids.
+ */
+class QTMODELLIBRARY_EXPORT ModelWriter
+{
+public:
+    explicit ModelWriter(QIODevice* device, int batchSize = 256);
+    ~ModelWriter();
+
+    /**
+     * @brief Adds a Model to the current frame, which is written once full or
+     *        when a Model of another type is written.
+     * @return true on success, false if a frame couldn't be written.
+     */
+    bool write(const Model* model);
+
+    /**
+     * @brief Writes the current frame, even if it isn't full.
+     * @return true on success, false if the device refused the data.
+     */
+    bool flush();
+
+private:
+    Q_DISABLE_COPY(ModelWriter)
+
+    QIODevice* m_device;
+    int m_batchSize;
+    std::shared_ptr<const ModelStreamSchema> m_schema;
+    QByteArray m_rows;
+    int m_rowCount{0};
+    QHash<QString, quint64> m_stringIndexes;
+    QList<QByteArray> m_strings;
+};
+
+/**
+ * @brief Reads the Models written by ModelWriter from a QIODevice. Works with
+ *        sequential devices: call next or nextRow whenever the device has new data
+ *        (e.g. on readyRead) until they return false or nullptr.
+ */
+class QTMODELLIBRARY_EXPORT ModelReader
+{
+public:
+    /**
+     * @param device The device to read from.
+     * @param metaObject The meta-object of the Model type of the stream.
+     */
+    ModelReader(QIODevice* device, const QMetaObject& metaObject);
+
+    /**
+     * @brief Reads the next row without creating a Model.
+     * @return true if a row was read, false if no complete frame is available yet
+     *         or the stream is invalid (see hasError).
+     */
+    bool nextRow(ModelRowView& row);
+
+    /**
+     * @brief Reads the next row into a new Model. Related Models are left to be
+     *        lazy loaded, just as if they were loaded with eagerLoad = false.
+     * @return A new Model owned by the caller, or nullptr if no complete frame is
+     *         available yet or the stream is invalid (see hasError).
+     */
+    Model* next();
+
+    /**
+     * @brief Checks whether the stream is invalid, e.g. because it was written for
+     *        another Model type or version. An invalid stream can't be read further.
+     */
+    bool hasError() const;
+
+private:
+    Q_DISABLE_COPY(ModelReader)
+
+    QIODevice* m_device;
+    std::shared_ptr<const ModelStreamSchema> m_schema;
+    QByteArray m_buffer;
+    QByteArray m_frame;
+    QList<QPair<qsizetype, qsizetype>> m_strings;
+    qsizetype m_position{0};
+    quint64 m_remainingRows{0};
+    bool m_error{false};
+
+    bool readFrame();
+    void fail(const QString& message);
+};
@@ -0,0 +1,678 @@
+#include <memory>
+#include <utility>
+#include <libpq-fe.h>
+#include <QDate>
+#include <QDebug>
+#include <QDateTime>
+#include <QSqlDriver>
+#include <QSqlDatabase>
+#include "PostgresBackend.hpp"
+
+namespace {
+
+using ResultPointer = std::unique_ptr<PGresult, decltype(&PQclear)>;
+
+// Flush the COPY buffer to the connection once it reaches this size
+constexpr qsizetype copyChunkSize = 64 * 1024;
+
+PGconn* connectionHandle()
+{
+    QSqlDatabase database = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+
+    if (!database.isOpen() || database.driverName() != "QPSQL")
+        return nullptr;
+
+    QVariant handle = database.driver()->handle();
+
+    if (!handle.isValid() || qstrcmp(handle.typeName(), "PGconn*") != 0)
+        return nullptr;
+
+    return *static_cast<PGconn* const*>(handle.constData());
+}
+
+ResultPointer exec(PGconn* connection, const QString& sql)
+{
+    return ResultPointer(PQexec(connection, sql.toUtf8().constData()), &PQclear);
+}
+
+/**
+ * @brief Converts a value to its PostgreSQL text representation.
+ */
+QByteArray textValue(const QVariant& value)
+{
+    switch (value.typeId()) {
+    case QMetaType::Bool:
+        return value.toBool() ? "t" : "f";
+    case QMetaType::QDate:
+        return value.toDate().toString(Qt::ISODate).toUtf8();
+    case QMetaType::QDateTime:
+        return value.toDateTime().toString(Qt::ISODateWithMs).toUtf8();
+    case QMetaType::QByteArray:
+        return "\\x" + value.toByteArray().toHex();
+    default:
+        return value.toString().toUtf8();
+    }
+}
+
+/**
+ * @brief Appends a value to a COPY text format row, escaping the characters that
+ *        have a meaning in that format.
+ */
+void appendCopyValue(QByteArray& buffer, const QVariant& value)
+{
+    if (!value.isValid() || value.isNull()) {
+        buffer += "\\N";
+        return;
+    }
+
+    QByteArray text = textValue(value);
+    buffer.reserve(buffer.size() + text.size());
+
+    for (char c : std::as_const(text)) {
+        switch (c) {
+        case '\\': buffer += "\\\\"; break;
+        case '\t': buffer += "\\t"; break;
+        case '\n': buffer += "\\n"; break;
+        case '\r': buffer += "\\r"; break;
+        default: buffer += c; break;
+        }
+    }
+}
+
+/**
+ * @brief Converts a text result value to a QVariant of the type of its column, so
+ *        related Model ids are recognized just like with the QPSQL driver.
+ */
+QVariant resultValue(const PGresult* result, int row, int column)
+{
+    if (PQgetisnull(result, row, column))
+        return QVariant();
+
+    const char* text = PQgetvalue(result, row, column);
+    int length = PQgetlength(result, row, column);
+
+    switch (PQftype(result, column)) {
+    case 16: // bool
+        return QVariant(text[0] == 't');
+    case 20: // int8
+    case 21: // int2
+    case 23: // int4
+        return QVariant(QByteArray(text, length).toLongLong());
+    case 700: // float4
+    case 701: // float8
+    case 1700: // numeric
+        return QVariant(QByteArray(text, length).toDouble());
+    case 17: { // bytea
+        size_t size = 0;
+        unsigned char* bytes = PQunescapeBytea(reinterpret_cast<const unsigned char*>(text), &size);
+        QByteArray value(reinterpret_cast<const char*>(bytes), qsizetype(size));
+        PQfreemem(bytes);
+        return QVariant(value);
+    }
+    default:
+        return QVariant(QString::fromUtf8(text, length));
+    }
+}
+
+/**
+ * @brief The statements prepared on the connection the pipeline last used.
+ */
+struct PreparedStatements {
+    PGconn* connection{nullptr};
+    int backendPid{0};
+    quint64 count{0};                 ///< So a name is never reused, even after a failed prepare
+    QHash<QString, QByteArray> names; ///< By SQL text
+};
+
+thread_local PreparedStatements connectionStatements;
+
+/**
+ * @brief Returns the statements prepared on the connection, forgetting them when the
+ *        connection was closed or reopened since, as the server dropped them with it.
+ */
+PreparedStatements& statementsOf(PGconn* connection)
+{
+    // A reopened connection may reuse the address of the closed one, but not its backend
+    int backendPid = PQbackendPID(connection);
+
+    if (connectionStatements.connection != connection || connectionStatements.backendPid != backendPid) {
+        connectionStatements = PreparedStatements();
+        connectionStatements.connection = connection;
+        connectionStatements.backendPid = backendPid;
+    }
+
+    return connectionStatements;
+}
+
+/**
+ * @brief Returns the name of the prepared statement for the SQL text, preparing it in
+ *        the pipeline if the connection doesn't have it yet.
+ * @param prepared Set to true if a prepare was queued, whose result must be consumed.
+ */
+QByteArray preparedStatement(PGconn* connection, const QString& sql, int paramCount, bool& prepared)
+{
+    PreparedStatements& statements = statementsOf(connection);
+    auto statement = statements.names.constFind(sql);
+    prepared = false;
+
+    if (statement != statements.names.constEnd())
+        return statement.value();
+
+    QByteArray name = QByteArray("model_pipeline_") + QByteArray::number(++statements.count);
+
+    if (PQsendPrepare(connection, name.constData(), sql.toUtf8().constData(), paramCount, nullptr) != 1)
+        return QByteArray();
+
+    prepared = true;
+    statements.names.insert(sql, name);
+    return name;
+}
+
+/**
+ * @brief Reads and discards the results of the operations sent in pipeline mode,
+ *        up to the end of the batch, so the connection can leave pipeline mode.
+ * @param syncs The number of PQpipelineSync calls the batch made already.
+ */
+void drainPipeline(PGconn* connection, int syncs)
+{
+    if (PQpipelineSync(connection) != 1) {
+        qWarning() << "Could not end the pipeline batch:" << PQerrorMessage(connection);
+        return;
+    }
+
+    // A null result ends the results of each statement, two in a row mean nothing is pending
+    bool previousWasNull = false;
+    int pendingSyncs = syncs + 1;
+
+    while (PQstatus(connection) == CONNECTION_OK) {
+        PGresult* result = PQgetResult(connection);
+
+        if (result == nullptr) {
+            if (previousWasNull)
+                return;
+
+            previousWasNull = true;
+            continue;
+        }
+
+        previousWasNull = false;
+        bool endOfSegment = PQresultStatus(result) == PGRES_PIPELINE_SYNC;
+        PQclear(result);
+
+        if (endOfSegment && --pendingSyncs == 0)
+            return;
+    }
+}
+
+}
+
+bool PostgresBackend::isAvailable()
+{
+    return connectionHandle() != nullptr;
+}
+
+bool PostgresBackend::inTransaction()
+{
+    PGconn* connection = connectionHandle();
+    return connection != nullptr && PQtransactionStatus(connection) != PQTRANS_IDLE;
+}
+
+bool PostgresBackend::copyInsert(const QList<Model*>& models)
+{
+    PGconn* connection = connectionHandle();
+
+    if (connection == nullptr) {
+        qCritical() << "COPY requires an open QPSQL default connection";
+        return false;
+    }
+
+    // A failure part-way must not leave a partial bulk insert behind, so everything runs
+    // in one transaction, or in a savepoint of the transaction of the application
+    bool ownsTransaction = PQtransactionStatus(connection) == PQTRANS_IDLE;
+    ResultPointer beginResult = exec(connection, ownsTransaction ? "BEGIN" : "SAVEPOINT model_copy_insert");
+
+    if (PQresultStatus(beginResult.get()) != PGRES_COMMAND_OK) {
+        qCritical() << "Could not begin the COPY transaction:" << PQerrorMessage(connection);
+        return false;
+    }
+
+    QList<Model*> insertedRelated;
+    QList<QPair<Model*, model_id_t>> reservedIds;
+    bool copied = copyModels(connection, models, insertedRelated, reservedIds);
+    QString end = ownsTransaction ? "COMMIT" : "RELEASE SAVEPOINT model_copy_insert";
+
+    if (!copied)
+        end = ownsTransaction ? "ROLLBACK" : "ROLLBACK TO SAVEPOINT model_copy_insert; RELEASE SAVEPOINT model_copy_insert";
+
+    ResultPointer endResult = exec(connection, end);
+
+    if (ownsTransaction)
+        Model::runDeferredInvalidations();
+
+    if (copied && PQresultStatus(endResult.get()) != PGRES_COMMAND_OK) {
+        qCritical() << "Could not commit the COPY:" << PQerrorMessage(connection);
+        copied = false;
+    } else if (!copied && PQresultStatus(endResult.get()) != PGRES_COMMAND_OK) {
+        qWarning() << "Could not roll back the COPY:" << PQerrorMessage(connection);
+    }
+
+    if (!copied) {
+        // Their rows were rolled back along with the COPY
+        for (Model* related : std::as_const(insertedRelated))
+            related->setId(0);
+
+        return false;
+    }
+
+    for (const auto& reserved : std::as_const(reservedIds))
+        reserved.first->setId(reserved.second);
+
+    return true;
+}
+
+bool PostgresBackend::copyModels(pg_conn* connection, const QList<Model*>& models, QList<Model*>& insertedRelated,
+                                 QList<QPair<Model*, model_id_t>>& reservedIds)
+{
+    QHash<const QMetaObject*, QList<Model*>> modelsByType;
+
+    for (Model* model : models) {
+        if (model->isSaved()) {
+            qWarning() << "Skipping Model" << model->id() << "which is already saved";
+            continue;
+        }
+
+        // Related Models need an id before their owners can reference it
+        bool relatedSaved = true;
+
+        model->forEachProperty([&relatedSaved, &insertedRelated, model](auto metaProperty) {
+            if (!Model::isPropertyModel(metaProperty))
+                return;
+
+            Model* related = metaProperty.read(model).template value<Model*>();
+
+            if (related == nullptr || related->isSaved())
+                return;
+
+            if (related->insert())
+                insertedRelated << related;
+            else
+                relatedSaved = false;
+        });
+
+        if (!relatedSaved)
+            return false;
+
+        modelsByType[model->metaObject()].append(model);
+    }
+
+    for (auto it = modelsByType.cbegin(); it != modelsByType.cend(); ++it) {
+        const QList<Model*>& batch = it.value();
+        QString table = batch.first()->tableName();
+        ResultPointer idsResult = exec(connection, QString("SELECT nextval(pg_get_serial_sequence('%1', 'id')) "
+                                                           "FROM generate_series(1, %2)").arg(table).arg(batch.size()));
+
+        if (PQresultStatus(idsResult.get()) != PGRES_TUPLES_OK) {
+            qCritical() << "Could not reserve ids:" << PQerrorMessage(connection);
+            return false;
+        }
+
+        QStringList columns{"id"};
+
+        batch.first()->forEachProperty([&columns](auto metaProperty) {
+            columns << metaProperty.name();
+        });
+
+        // Dictionary codes are looked up with QtSql, which can't run during the COPY
+        QHash<QPair<QString, QString>, QVariant> codes;
+        QList<QVariantList> rows;
+        rows.reserve(batch.size());
+
+        for (Model* model : batch) {
+            QVariantList& row = rows.emplace_back();
+
+            model->forEachProperty([&row, &codes, model](auto metaProperty) {
+                QVariant value = metaProperty.read(model);
+
+                if (value.isNull() || !model->isPropertyDictionary(metaProperty)) {
+                    row << model->databaseValue(metaProperty);
+                    return;
+                }
+
+                auto key = qMakePair(model->dictionaryTable(metaProperty), value.toString());
+                auto code = codes.constFind(key);
+                row << (code != codes.constEnd() ? code.value() : codes.insert(key, model->databaseValue(metaProperty)).value());
+            });
+        }
+
+        ResultPointer copyResult = exec(connection, QString("COPY %1 (%2) FROM STDIN").arg(table, columns.join(',')));
+
+        if (PQresultStatus(copyResult.get()) != PGRES_COPY_IN) {
+            qCritical() << "Could not start COPY:" << PQerrorMessage(connection);
+            return false;
+        }
+
+        QByteArray buffer;
+        buffer.reserve(copyChunkSize + 4096);
+        bool sent = true;
+
+        for (qsizetype i = 0; i < batch.size() && sent; ++i) {
+            buffer += PQgetvalue(idsResult.get(), int(i), 0);
+
+            for (const QVariant& value : std::as_const(rows.at(i))) {
+                buffer += '\t';
+                appendCopyValue(buffer, value);
+            }
+
+            buffer += '\n';
+
+            if (buffer.size() >= copyChunkSize) {
+                sent = PQputCopyData(connection, buffer.constData(), int(buffer.size())) == 1;
+                buffer.clear();
+            }
+        }
+
+        if (sent && !buffer.isEmpty())
+            sent = PQputCopyData(connection, buffer.constData(), int(buffer.size())) == 1;
+
+        if (PQputCopyEnd(connection, sent ? nullptr : "Could not send the COPY data") != 1) {
+            qCritical() << "Could not end COPY:" << PQerrorMessage(connection);
+            return false;
+        }
+
+        bool copied = true;
+
+        while (PGresult* result = PQgetResult(connection)) {
+            if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+                qCritical() << "Could not COPY into" << table << ":" << PQresultErrorMessage(result);
+                copied = false;
+            }
+
+            PQclear(result);
+        }
+
+        Model::invalidateQueries(table);
+
+        if (!copied)
+            return false;
+
+        if (!applyCounterCaches(connection, batch))
+            return false;
+
+        // Assigned once the transaction commits
+        for (qsizetype i = 0; i < batch.size(); ++i)
+            reservedIds << qMakePair(batch.at(i), QByteArray(PQgetvalue(idsResult.get(), int(i), 0)).toULongLong());
+    }
+
+    return true;
+}
+
+bool PostgresBackend::applyCounterCaches(pg_conn* connection, const QList<Model*>& batch)
+{
+    const QList<Model::CounterCache> caches = batch.first()->counterCaches();
+
+    for (const Model::CounterCache& cache : caches) {
+        const QMetaObject* metaObject = batch.first()->metaObject();
+        QMetaProperty relation = metaObject->property(metaObject->indexOfProperty(cache.relation.toLocal8Bit()));
+
+        if (!Model::isPropertyModel(relation)) {
+            qWarning() << QString(R"(Counter cache relation "%1" is not a related Model)").arg(cache.relation);
+            continue;
+        }
+
+        // Every row is new, so each parent only grows by the rows that reference it
+        QHash<model_id_t, double> deltas;
+        bool integral = true;
+
+        for (Model* model : batch) {
+            Model* related = relation.read(model).value<Model*>();
+
+            if (related == nullptr || !related->isSaved())
+                continue;
+
+            QVariant summed = cache.summed.isEmpty() ? QVariant(1) : model->property(cache.summed.toLocal8Bit());
+            integral = integral && summed.typeId() != QMetaType::Double && summed.typeId() != QMetaType::Float;
+            deltas[related->id()] += summed.toDouble();
+        }
+
+        std::unique_ptr<Model> parent(batch.first()->createRelatedInstance(relation));
+        QByteArray sql = QString("UPDATE %1 SET %2 = COALESCE(%2, 0) + $1 WHERE id = $2")
+                             .arg(parent->tableName(), cache.column).toUtf8();
+
+        for (auto it = deltas.cbegin(); it != deltas.cend(); ++it) {
+            if (it.value() == 0)
+                continue;
+
+            QByteArray delta = integral ? QByteArray::number(qRound64(it.value())) : QByteArray::number(it.value(), 'g', 17);
+            QByteArray id = QByteArray::number(it.key());
+            const char* params[] = {delta.constData(), id.constData()};
+            ResultPointer result(PQexecParams(connection, sql.constData(), 2, nullptr, params, nullptr, nullptr, 0), &PQclear);
+
+            if (PQresultStatus(result.get()) != PGRES_COMMAND_OK) {
+                qCritical() << "Could not update counter cache:" << PQresultErrorMessage(result.get());
+                return false;
+            }
+
+            Model::invalidateSharedRow(parent->tableName(), it.key());
+        }
+
+        Model::invalidateQueries(parent->tableName());
+    }
+
+    return true;
+}
+
+PostgresPipeline::PostgresPipeline(int syncInterval)
+    : m_syncInterval{qMax(1, syncInterval)}
+{
+}
+
+void PostgresPipeline::load(Model* model, model_id_t id)
+{
+    m_queue.append({Operation::Load, model, id});
+}
+
+void PostgresPipeline::update(Model* model)
+{
+    if (!model->isSaved() || !model->isModified())
+        return;
+
+    // The caches need the row before and after the write, which can't be read in between
+    if (!model->modifiedCounterCaches().isEmpty()) {
+        qWarning() << "Can't pipeline the update of Model" << model->id() << "which changes counter or sum caches,"
+                   << "use Model::update instead";
+        m_rejected = true;
+        return;
+    }
+
+    m_queue.append({Operation::Update, model, model->id()});
+}
+
+bool PostgresPipeline::exec()
+{
+    PGconn* connection = connectionHandle();
+
+    if (connection == nullptr) {
+        qCritical() << "Pipelining requires an open QPSQL default connection";
+        m_queue.clear();
+        m_rejected = false;
+        return false;
+    }
+
+    for (QueuedOperation& queued : m_queue) {
+        if (queued.operation != Operation::Update || queued.model == nullptr)
+            continue;
+
+        for (const QString& propertyName : queued.model->modifiedProperties()) {
+            int propertyIndex = queued.model->metaObject()->indexOfProperty(propertyName.toLocal8Bit());
+            QVariant value = queued.model->databaseValue(queued.model->metaObject()->property(propertyIndex));
+            queued.properties << propertyName;
+            queued.values << (value.isNull() ? QByteArray() : textValue(value));
+        }
+    }
+
+    if (PQenterPipelineMode(connection) != 1) {
+        qCritical() << "Could not enter pipeline mode:" << PQerrorMessage(connection);
+        m_queue.clear();
+        m_rejected = false;
+        return false;
+    }
+
+    bool succeeded = true;
+    bool sent = true;
+
+    // A batch that couldn't be sent leaves the connection in an unknown state, so stop there
+    for (qsizetype begin = 0; sent && begin < m_queue.size(); begin += m_syncInterval)
+        sent = execBatch(connection, begin, qMin(begin + m_syncInterval, m_queue.size()), succeeded);
+
+    succeeded = succeeded && sent;
+
+    if (PQexitPipelineMode(connection) != 1)
+        qWarning() << "Could not exit pipeline mode:" << PQerrorMessage(connection);
+
+    for (const QueuedOperation& queued : std::as_const(m_queue)) {
+        if (queued.operation != Operation::Load || queued.model == nullptr || queued.row.isEmpty())
+            continue;
+
+        Model::RowPlan rowPlan = queued.model->planRow(false, nullptr, false);
+        const QVariantHash& row = queued.row;
+
+        // PostgreSQL folds the unquoted column names of the SELECT to lower case
+        if (queued.model->readRow([&row](const QString& column) { return row.value(column.toLower()); }, QString(), rowPlan))
+            queued.model->setId(queued.id);
+        else
+            succeeded = false;
+    }
+
+    succeeded = succeeded && !m_rejected;
+    m_queue.clear();
+    m_rejected = false;
+    return succeeded;
+}
+
+bool PostgresPipeline::execBatch(pg_conn* connection, qsizetype begin, qsizetype end, bool& succeeded)
+{
+    // For every queued statement: the SQL text if a prepare result precedes its own result
+    QStringList preparedStatements;
+    int syncs = 0;
+
+    for (qsizetype i = begin; i < end; ++i) {
+        const QueuedOperation& queued = m_queue.at(i);
+        Model* model = queued.model;
+        QStringList queryStr;
+        QList<QByteArray> values;
+
+        if (model == nullptr) {
+            preparedStatements.append(QString());
+            continue;
+        }
+
+        if (queued.operation == Operation::Load) {
+            queryStr << "SELECT ";
+
+            model->forEachProperty([&queryStr](auto metaProperty) {
+                queryStr << metaProperty.name() << ",";
+            });
+
+            queryStr.removeLast(); // trailing comma
+            queryStr << " FROM " << model->tableName() << " WHERE id = $1";
+        } else {
+            queryStr << "UPDATE " << model->tableName() << " SET ";
+            values = queued.values;
+
+            for (qsizetype property = 0; property < queued.properties.size(); ++property)
+                queryStr << queued.properties.at(property) << QString(" = $%1,").arg(property + 1);
+
+            queryStr.last().chop(1); // remove trailing comma
+            queryStr << QString(" WHERE id = $%1").arg(values.size() + 1);
+        }
+
+        values << QByteArray::number(queued.id);
+        QList<const char*> params;
+
+        for (const QByteArray& value : std::as_const(values))
+            params << (value.isNull() ? nullptr : value.constData());
+
+        bool prepared = false;
+        QString sql = queryStr.join("");
+        QByteArray statement = preparedStatement(connection, sql, int(params.size()), prepared);
+
+        if (prepared)
+            preparedStatements.append(sql);
+
+        if (statement.isNull() || PQsendQueryPrepared(connection, statement.constData(), int(params.size()),
+                                                      params.constData(), nullptr, nullptr, 0) != 1) {
+            qCritical() << "Could not queue pipelined statement:" << PQerrorMessage(connection);
+            abortBatch(connection, preparedStatements, syncs);
+            return false;
+        }
+
+        if (!prepared)
+            preparedStatements.append(QString());
+
+        // The statements up to a sync run in one implicit transaction, where a failure
+        // would roll back the updates before it, so every operation gets its own
+        if (PQpipelineSync(connection) != 1) {
+            qCritical() << "Could not send pipeline:" << PQerrorMessage(connection);
+            abortBatch(connection, preparedStatements, syncs);
+            return false;
+        }
+
+        ++syncs;
+    }
+
+    for (qsizetype i = begin; i < end; ++i) {
+        QueuedOperation& queued = m_queue[i];
+        Model* model = queued.model;
+
+        if (model == nullptr)
+            continue;
+
+        if (!preparedStatements.at(i - begin).isEmpty()) {
+            ResultPointer prepareResult(PQgetResult(connection), &PQclear);
+            PQgetResult(connection); // end of the prepare results
+
+            // Don't reuse a statement whose prepare failed or was aborted
+            if (PQresultStatus(prepareResult.get()) != PGRES_COMMAND_OK)
+                statementsOf(connection).names.remove(preparedStatements.at(i - begin));
+        }
+
+        ResultPointer result(PQgetResult(connection), &PQclear);
+        PQgetResult(connection); // end of the statement results
+        ExecStatusType status = PQresultStatus(result.get());
+
+        // Consume the PGRES_PIPELINE_SYNC result that ends the operation
+        PQclear(PQgetResult(connection));
+
+        if (queued.operation == Operation::Load) {
+            if (status != PGRES_TUPLES_OK || PQntuples(result.get()) != 1) {
+                qCritical() << "Could not load pipelined Model" << queued.id << ":" << PQresultErrorMessage(result.get());
+                succeeded = false;
+                continue;
+            }
+
+            for (int column = 0; column < PQnfields(result.get()); ++column)
+                queued.row.insert(PQfname(result.get(), column), resultValue(result.get(), 0, column));
+        } else {
+            Model::invalidateQueries(model->tableName());
+            Model::invalidateSharedRow(model->tableName(), queued.id);
+
+            if (status != PGRES_COMMAND_OK) {
+                qCritical() << "Could not update pipelined Model" << queued.id << ":" << PQresultErrorMessage(result.get());
+                succeeded = false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void PostgresPipeline::abortBatch(pg_conn* connection, const QStringList& preparedStatements, int syncs)
+{
+    drainPipeline(connection, syncs);
+
+    // Whether the prepares queued by the batch ran is unknown, so they are prepared again
+    for (const QString& sql : preparedStatements) {
+        if (!sql.isEmpty())
+            statementsOf(connection).names.remove(sql);
+    }
+}
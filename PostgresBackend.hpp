@@ -0,0 +1,146 @@
+#pragma once
+
+#include <QList>
+#include <QPair>
+#include <QPointer>
+#include <QVariantHash>
+#include "Model.hpp"
+
+struct pg_conn;
+
+/**
+ * @brief Executes bulk Model operations directly on the libpq connection handle of
+ *        the default QPSQL connection, bypassing the QtSql driver.
+ *
+ *        The QPSQL plugin must be linked against the same libpq as this library.
+ */
+class QTMODELLIBRARY_EXPORT PostgresBackend
+{
+public:
+    /**
+     * @brief Checks whether the default database connection is an open QPSQL connection.
+     * @return true if the PostgreSQL backend can be used, false otherwise.
+     */
+    static bool isAvailable();
+
+    /**
+     * @brief Checks whether a transaction is in progress on the default connection,
+     *        including the ones the application opened.
+     * @return true if the connection isn't idle, false otherwise.
+     */
+    static bool inTransaction();
+
+    /**
+     * @brief Inserts the given unsaved Models with COPY FROM STDIN in text format,
+     *        which is an order of magnitude faster than INSERT for large collections.
+     *        The ids are reserved beforehand, in a single round trip per table, from
+     *        the sequence of the id column and are assigned to the Models only if the
+     *        whole COPY succeeds. Unsaved related Models are inserted first.
+     *        Everything runs in a single transaction, or in a savepoint when the
+     *        application has a transaction open, so nothing is inserted on failure.
+     *        Counter and sum caches are updated with one UPDATE per parent.
+     *        The overridable insertQuery is not used.
+     * @param models The Models to insert. They may be of different types.
+     * @return true if every Model was inserted, false otherwise.
+     */
+    static bool copyInsert(const QList<Model*>& models);
+
+private:
+    /**
+     * @brief Inserts the related Models, then COPYs the Models table by table.
+     * @param insertedRelated Receives the related Models inserted.
+     * @param reservedIds Receives the id reserved for each Model.
+     * @return true if every table was copied, false otherwise.
+     */
+    static bool copyModels(pg_conn* connection, const QList<Model*>& models, QList<Model*>& insertedRelated,
+                           QList<QPair<Model*, model_id_t>>& reservedIds);
+
+    /**
+     * @brief Adds the Models of a COPY of a single type to the counter and sum caches
+     *        of their parents.
+     * @return true if every cache could be updated, false otherwise.
+     */
+    static bool applyCounterCaches(pg_conn* connection, const QList<Model*>& batch);
+};
+
+/**
+ * @brief Queues independent load and update operations and sends them to PostgreSQL
+ *        together with the libpq (14+) pipeline mode, so they cost a single network
+ *        round trip instead of one each. The results are matched back to their Models
+ *        in queue order. Statements are prepared once per connection.
+ *
+ *        Related Models are not loaded by a pipelined load; their ids are kept for
+ *        Lazy Loading as if Model::load was called with eagerLoad = false. Updated
+ *        related Models must already be saved.
+ *
+ * @code
+ * PostgresPipeline pipeline;
+ * pipeline.load(&alice, 1);
+ * pipeline.load(&bob, 2);
+ * pipeline.update(&carol);
+ * pipeline.exec();
+ * @endcode
+ */
+class QTMODELLIBRARY_EXPORT PostgresPipeline
+{
+public:
+    /**
+     * @param syncInterval How many operations are sent before waiting for their
+     *        results, which bounds the data buffered on either side of the socket.
+     */
+    explicit PostgresPipeline(int syncInterval = 256);
+
+    /**
+     * @brief Queues loading the Model with the given id.
+     */
+    void load(Model* model, model_id_t id);
+
+    /**
+     * @brief Queues updating the modified properties of the Model. Models that are
+     *        not saved or not modified are ignored, just like Model::update does.
+     *        Updates that change a counter or sum cache are rejected, and make exec
+     *        return false, since the cache needs the row as it was before the write.
+     */
+    void update(Model* model);
+
+    /**
+     * @brief Sends the queued operations and reads their results. Each operation
+     *        runs in its own implicit transaction, unless the application has one
+     *        open, so a failed update doesn't undo the others. The queue is emptied
+     *        even if some operation fails.
+     * @return true if every operation succeeded, false otherwise.
+     */
+    bool exec();
+
+private:
+    enum class Operation { Load, Update };
+
+    // Dictionary codes are looked up with QtSql, which can't run in pipeline mode, so
+    // the values of updates are resolved before it and loaded rows are read after it
+    struct QueuedOperation {
+        Operation operation;
+        QPointer<Model> model;
+        model_id_t id;
+        QStringList properties;     ///< The properties an update writes
+        QList<QByteArray> values;   ///< Their values in text format, null for NULL
+        QVariantHash row;           ///< The row a load read, keyed by column
+    };
+
+    int m_syncInterval;
+    QList<QueuedOperation> m_queue;
+    bool m_rejected{false};
+
+    /**
+     * @brief Sends the queued operations from begin to end and reads their results.
+     * @param succeeded Set to false if some operation failed.
+     * @return true if the batch could be sent, false if the connection can't be used further.
+     */
+    bool execBatch(pg_conn* connection, qsizetype begin, qsizetype end, bool& succeeded);
+
+    /**
+     * @brief Discards the results of a batch that couldn't be sent completely.
+     * @param preparedStatements The SQL text of the statements the batch prepared.
+     * @param syncs The number of operations of the batch already followed by a sync.
+     */
+    static void abortBatch(pg_conn* connection, const QStringList& preparedStatements, int syncs);
+};
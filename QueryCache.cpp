@@ -0,0 +1,159 @@
+#include <atomic>
+#include <QSet>
+#include <QCache>
+#include <QMutex>
+#include <QDataStream>
+#include <QDeadlineTimer>
+#include "QueryCache.hpp"
+
+namespace {
+
+std::atomic_bool cacheEnabled{false};
+QMutex mutex;
+// The keys of the results that depend on each table
+QHash<QString, QSet<QString>> keysByTable;
+// Bumped by every invalidation, so a result read before a write isn't cached after it
+QHash<QString, quint64> generations;
+int timeToLive = 60 * 1000;
+
+struct Result {
+    QString key;
+    QList<model_id_t> ids;
+    QStringList tables;
+    QDeadlineTimer expiry;
+
+    // Runs with the mutex held, whether the result is evicted, expired or invalidated
+    ~Result()
+    {
+        for (const QString& table : std::as_const(tables)) {
+            auto keys = keysByTable.find(table);
+
+            if (keys == keysByTable.end())
+                continue;
+
+            keys->remove(key);
+
+            if (keys->isEmpty())
+                keysByTable.erase(keys);
+        }
+    }
+};
+
+QCache<QString, Result> results(8 * 1024 * 1024);
+
+QString cacheKey(const QString& sql, const QVariantList& bindValues)
+{
+    QByteArray values;
+    QDataStream out(&values, QIODevice::WriteOnly);
+    out << bindValues;
+    return sql.simplified() + QChar(0) + QString::fromLatin1(values.toBase64());
+}
+
+}
+
+bool QueryCache::isEnabled()
+{
+    return cacheEnabled;
+}
+
+void QueryCache::setEnabled(bool enabled)
+{
+    cacheEnabled = enabled;
+
+    if (!enabled)
+        clear();
+}
+
+void QueryCache::setTimeToLive(int msecs)
+{
+    QMutexLocker locker(&mutex);
+    timeToLive = msecs;
+}
+
+void QueryCache::setMaxSize(qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+    results.setMaxCost(bytes);
+}
+
+void QueryCache::clear()
+{
+    QMutexLocker locker(&mutex);
+    results.clear();
+    keysByTable.clear();
+}
+
+bool QueryCache::lookup(const QString& sql, const QVariantList& bindValues, QList<model_id_t>& ids)
+{
+    if (!isEnabled())
+        return false;
+
+    QString key = cacheKey(sql, bindValues);
+    QMutexLocker locker(&mutex);
+    Result* result = results.object(key);
+
+    if (result == nullptr)
+        return false;
+
+    if (result->expiry.hasExpired()) {
+        results.remove(key);
+        return false;
+    }
+
+    ids = result->ids;
+    return true;
+}
+
+quint64 QueryCache::generation(const QStringList& tables)
+{
+    QMutexLocker locker(&mutex);
+    quint64 sum = 0;
+
+    // Generations only grow, so the sum changes whenever one of them does
+    for (const QString& table : tables)
+        sum += generations.value(table);
+
+    return sum;
+}
+
+void QueryCache::insert(const QString& sql, const QVariantList& bindValues, const QStringList& tables,
+                        const QList<model_id_t>& ids, quint64 generation)
+{
+    if (!isEnabled())
+        return;
+
+    QString key = cacheKey(sql, bindValues);
+    QMutexLocker locker(&mutex);
+    quint64 current = 0;
+
+    for (const QString& table : tables)
+        current += generations.value(table);
+
+    // A table was written while the query ran, the result may already be stale
+    if (current != generation)
+        return;
+
+    // Replacing a result deletes the old one, which unregisters the key
+    results.remove(key);
+
+    auto result = new Result{key, ids, tables, QDeadlineTimer(timeToLive)};
+    qsizetype cost = ids.size() * qsizetype(sizeof(model_id_t)) + key.size() * qsizetype(sizeof(QChar)) + qsizetype(sizeof(Result));
+
+    if (!results.insert(key, result, cost))
+        return; // Too large for the cache, already deleted
+
+    for (const QString& table : tables)
+        keysByTable[table].insert(key);
+}
+
+void QueryCache::invalidate(const QString& table)
+{
+    if (!isEnabled())
+        return;
+
+    QMutexLocker locker(&mutex);
+    generations[table] += 1;
+
+    for (const QString& key : keysByTable.take(table))
+        results.remove(key);
+}
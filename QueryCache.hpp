@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QList>
+#include <QVariantList>
+#include "Model.hpp"
+
+/**
+ * @brief Caches the ids returned by the queries of Model::find and Model::search,
+ *        keyed by the normalized SQL and the bound values. Every write made through
+ *        Model (insert, update, deleteFromDatabase, counter caches and the bulk
+ *        operations) invalidates the cached queries that depend on the written table.
+ *        Writes made outside of this library are not seen, hence the time to live.
+ *
+ *        The cache is disabled by default.
+ */
+class QTMODELLIBRARY_EXPORT QueryCache
+{
+public:
+    static bool isEnabled();
+    static void setEnabled(bool enabled);
+
+    /**
+     * @brief Sets how long a cached result is used. Defaults to 60 seconds.
+     */
+    static void setTimeToLive(int msecs);
+
+    /**
+     * @brief Sets the approximate memory the cached results may use. The least
+     *        recently used results are evicted first. Defaults to 8 MiB.
+     */
+    static void setMaxSize(qint64 bytes);
+
+    /**
+     * @brief Discards every cached result.
+     */
+    static void clear();
+
+    /**
+     * @brief Looks up the cached ids of a query.
+     * @param sql The SQL text of the query.
+     * @param bindValues The values bound to the query.
+     * @param ids Receives the cached ids.
+     * @return true if the result is cached and still alive, false otherwise.
+     */
+    static bool lookup(const QString& sql, const QVariantList& bindValues, QList<model_id_t>& ids);
+
+    /**
+     * @brief The generation of the given tables, which changes whenever one of them
+     *        is invalidated. Take it before running a query and pass it to insert.
+     */
+    static quint64 generation(const QStringList& tables);
+
+    /**
+     * @brief Caches the ids returned by a query, unless one of its tables was
+     *        invalidated since the generation was taken.
+     * @param tables The tables the result depends on.
+     * @param generation The generation of the tables before the query ran.
+     */
+    static void insert(const QString& sql, const QVariantList& bindValues, const QStringList& tables,
+                       const QList<model_id_t>& ids, quint64 generation);
+
+    /**
+     * @brief Discards the cached results that depend on the given table.
+     */
+    static void invalidate(const QString& table);
+};
@@ -0,0 +1,269 @@
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <QMutex>
+#include <QThread>
+#include <QDataStream>
+#include <QSharedMemory>
+#include "SharedRowCache.hpp"
+#include "Encoding.hpp"
+
+namespace {
+
+constexpr quint32 segmentMagic = 0x514d5243; // "QMRC"
+constexpr int maxProbes = 8;
+constexpr int maxLockAttempts = 1024;
+
+struct SegmentHeader {
+    quint32 magic;
+    quint32 slotCount;
+    quint32 slotSize;
+    quint32 reserved;
+};
+
+/**
+ * @brief The header of a slot, followed by the serialized row. The sequence is odd
+ *        while the slot is being written.
+ */
+struct SlotHeader {
+    QAtomicInteger<quint32> sequence;
+    quint32 size;
+    quint64 table; ///< The hash of the table name, 0 for an empty slot
+    quint64 id;
+};
+
+QMutex mutex;
+QSharedMemory* segment = nullptr;
+SegmentHeader* header = nullptr;
+// One stamp per home slot, bumped by every invalidation of a row hashed there
+QAtomicInteger<quint32>* stamps = nullptr;
+char* slots = nullptr;
+std::atomic_bool attached{false};
+
+// Never 0, which marks an empty slot
+quint64 tableHash(const QString& table)
+{
+    return Encoding::fnv1a(table.toUtf8()) | 1;
+}
+
+quint64 homeIndex(quint64 table, model_id_t id)
+{
+    return ((table ^ id) * 0x9E3779B97F4A7C15ULL >> 17) % header->slotCount;
+}
+
+SlotHeader* slotAt(quint64 index)
+{
+    return reinterpret_cast<SlotHeader*>(slots + (index % header->slotCount) * header->slotSize);
+}
+
+char* payload(SlotHeader* slot)
+{
+    return reinterpret_cast<char*>(slot + 1);
+}
+
+quint32 payloadSize()
+{
+    return header->slotSize - quint32(sizeof(SlotHeader));
+}
+
+bool lockSlot(SlotHeader* slot, quint32& sequence, int attempts)
+{
+    for (int i = 0; i < attempts; ++i) {
+        sequence = slot->sequence.loadRelaxed();
+
+        if ((sequence & 1) == 0 && slot->sequence.testAndSetOrdered(sequence, sequence + 1))
+            return true;
+
+        QThread::yieldCurrentThread();
+    }
+
+    // Busy, or left locked by a process that died while writing it, which is never read
+    return false;
+}
+
+}
+
+bool SharedRowCache::attach(const QString& key, int slotCount, int slotSize)
+{
+    QMutexLocker locker(&mutex);
+
+    if (segment != nullptr) {
+        qWarning() << "The shared row cache is already attached";
+        return false;
+    }
+
+    slotSize = (qMax(slotSize, int(sizeof(SlotHeader)) + 64) + 7) & ~7;
+    qsizetype slotsOffset = (qsizetype(sizeof(SegmentHeader)) + slotCount * qsizetype(sizeof(quint32)) + 7) & ~7;
+    qsizetype size = slotsOffset + qsizetype(slotCount) * slotSize;
+    auto memory = std::make_unique<QSharedMemory>(key);
+    bool created = memory->create(size);
+
+    if (!created && (memory->error() != QSharedMemory::AlreadyExists || !memory->attach())) {
+        qCritical() << "Could not attach the shared row cache:" << memory->errorString();
+        return false;
+    }
+
+    memory->lock();
+    auto segmentHeader = static_cast<SegmentHeader*>(memory->data());
+
+    // Whoever locks the segment first initializes it, not necessarily its creator
+    if (segmentHeader->magic == 0) {
+        std::memset(memory->data(), 0, size_t(size));
+        segmentHeader->slotCount = quint32(slotCount);
+        segmentHeader->slotSize = quint32(slotSize);
+        segmentHeader->magic = segmentMagic;
+    }
+
+    bool compatible = segmentHeader->magic == segmentMagic && segmentHeader->slotCount == quint32(slotCount)
+                      && segmentHeader->slotSize == quint32(slotSize) && memory->size() >= size;
+    memory->unlock();
+
+    if (!compatible) {
+        qCritical() << "The shared row cache" << key << "was created with a different layout";
+        return false;
+    }
+
+    header = segmentHeader;
+    stamps = reinterpret_cast<QAtomicInteger<quint32>*>(static_cast<char*>(memory->data()) + sizeof(SegmentHeader));
+    slots = static_cast<char*>(memory->data()) + slotsOffset;
+    segment = memory.release();
+    attached = true;
+    return true;
+}
+
+void SharedRowCache::detach()
+{
+    QMutexLocker locker(&mutex);
+    attached = false;
+
+    if (segment == nullptr)
+        return;
+
+    segment->detach();
+    delete segment;
+    segment = nullptr;
+    header = nullptr;
+    stamps = nullptr;
+    slots = nullptr;
+}
+
+bool SharedRowCache::isAttached()
+{
+    return attached;
+}
+
+quint32 SharedRowCache::stamp(const QString& table, model_id_t id)
+{
+    if (!attached)
+        return 0;
+
+    return stamps[homeIndex(tableHash(table), id)].loadAcquire();
+}
+
+bool SharedRowCache::lookup(const QString& table, model_id_t id, QVariantHash& row)
+{
+    if (!attached)
+        return false;
+
+    quint64 hash = tableHash(table);
+    quint64 home = homeIndex(hash, id);
+    QByteArray buffer;
+
+    for (int probe = 0; probe < maxProbes; ++probe) {
+        SlotHeader* slot = slotAt(home + probe);
+        quint32 sequence = slot->sequence.loadAcquire();
+        quint32 size = slot->size;
+
+        if ((sequence & 1) != 0 || slot->table != hash || slot->id != id || size > payloadSize())
+            continue;
+
+        buffer.resize(size);
+        std::memcpy(buffer.data(), payload(slot), size_t(buffer.size()));
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // A writer changed the slot while it was copied
+        if (slot->sequence.loadRelaxed() != sequence)
+            continue;
+
+        QDataStream in(buffer);
+        in >> row;
+        return in.status() == QDataStream::Ok;
+    }
+
+    return false;
+}
+
+void SharedRowCache::insert(const QString& table, model_id_t id, const QVariantHash& row, quint32 stamp)
+{
+    if (!attached)
+        return;
+
+    QByteArray buffer;
+    QDataStream out(&buffer, QIODevice::WriteOnly);
+    out << row;
+
+    if (buffer.size() > qsizetype(payloadSize()))
+        return;
+
+    quint64 hash = tableHash(table);
+    quint64 home = homeIndex(hash, id);
+    SlotHeader* same = nullptr;
+    SlotHeader* empty = nullptr;
+
+    for (int probe = 0; probe < maxProbes && same == nullptr; ++probe) {
+        SlotHeader* slot = slotAt(home + probe);
+
+        if (slot->table == hash && slot->id == id)
+            same = slot;
+        else if (empty == nullptr && slot->table == 0)
+            empty = slot;
+    }
+
+    // The slot of the row, else an empty one, else the home slot is evicted
+    SlotHeader* target = same != nullptr ? same : empty != nullptr ? empty : slotAt(home);
+    quint32 sequence = 0;
+
+    // Another process is writing the slot, the row will be cached by the next load
+    if (!lockSlot(target, sequence, 1))
+        return;
+
+    // The lock must be visible before the stamp is read, see remove
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (stamps[home].loadRelaxed() == stamp) {
+        target->table = hash;
+        target->id = id;
+        target->size = quint32(buffer.size());
+        std::memcpy(payload(target), buffer.constData(), size_t(buffer.size()));
+    }
+
+    target->sequence.storeRelease(sequence + 2);
+}
+
+void SharedRowCache::remove(const QString& table, model_id_t id)
+{
+    if (!attached)
+        return;
+
+    quint64 hash = tableHash(table);
+    quint64 home = homeIndex(hash, id);
+    stamps[home].fetchAndAddOrdered(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // A writer that read the old stamp still holds its slot locked, so wait for each slot
+    for (int probe = 0; probe < maxProbes; ++probe) {
+        SlotHeader* slot = slotAt(home + probe);
+        quint32 sequence = 0;
+
+        if (!lockSlot(slot, sequence, maxLockAttempts))
+            continue;
+
+        if (slot->table == hash && slot->id == id) {
+            slot->table = 0;
+            slot->id = 0;
+            slot->size = 0;
+        }
+
+        slot->sequence.storeRelease(sequence + 2);
+    }
+}
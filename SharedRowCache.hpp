@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QVariantHash>
+#include "Model.hpp"
+
+/**
+ * @brief Caches the rows read by Model::load in a shared memory segment, so every
+ *        process of a host that attaches to the same key shares one cache instead of
+ *        warming its own. Meant for prefork deployments with many worker processes.
+ *
+ *        The segment is a fixed size open addressing table of serialized rows, keyed
+ *        by table and id. Each slot is guarded by a sequence lock: readers never block,
+ *        they retry on the next load when they race with a writer, and a writer that
+ *        finds a slot being written simply skips it. Every write made through Model
+ *        invalidates the written row, again once its transaction ends, and the cache
+ *        isn't used inside transactions. Writes made outside of this library are
+ *        not seen.
+ *
+ *        The cache is disabled until attach is called.
+ */
+class QTMODELLIBRARY_EXPORT SharedRowCache
+{
+public:
+    /**
+     * @brief Creates the shared memory segment, or attaches to the one already created
+     *        by another process with the same key and layout.
+     * @param key The key shared by the processes, e.g. the application name.
+     * @param slotCount The number of rows the cache holds.
+     * @param slotSize The size of each slot in bytes. Larger rows are not cached.
+     * @return true if the cache can be used, false otherwise.
+     */
+    static bool attach(const QString& key, int slotCount = 65536, int slotSize = 512);
+
+    /**
+     * @brief Detaches from the segment, which is destroyed with the last process.
+     *        Must not be called while other threads use Models.
+     */
+    static void detach();
+
+    static bool isAttached();
+
+    /**
+     * @brief Reads the invalidation stamp of a row. A row read from the database after
+     *        reading the stamp may only be cached with that stamp, so a row invalidated
+     *        while it was being read is never cached.
+     */
+    static quint32 stamp(const QString& table, model_id_t id);
+
+    /**
+     * @brief Looks up a cached row.
+     * @param row Receives the column values of the row.
+     * @return true if the row is cached, false otherwise.
+     */
+    static bool lookup(const QString& table, model_id_t id, QVariantHash& row);
+
+    /**
+     * @brief Caches a row, unless it was invalidated since the given stamp was read.
+     */
+    static void insert(const QString& table, model_id_t id, const QVariantHash& row, quint32 stamp);
+
+    /**
+     * @brief Invalidates a cached row.
+     */
+    static void remove(const QString& table, model_id_t id);
+};
@@ -0,0 +1,186 @@
+#include <atomic>
+#include <sqlite3.h>
+#include <QCache>
+#include <QDebug>
+#include <QPointer>
+#include <QSqlDriver>
+#include <QSqlDatabase>
+#include "SqliteBackend.hpp"
+
+namespace {
+
+std::atomic_bool nativeEnabled{true};
+
+sqlite3* driverHandle(const QSqlDriver* driver)
+{
+    QVariant handle = driver->handle();
+
+    if (!handle.isValid() || qstrcmp(handle.typeName(), "sqlite3*") != 0)
+        return nullptr;
+
+    return *static_cast<sqlite3* const*>(handle.constData());
+}
+
+/**
+ * @brief Prepared statements of the current thread keyed by SQL text, for the
+ *        connection they were last used with. QSqlDatabase connections can only be
+ *        used by the thread that created them, so there is no need to share the cache
+ *        between threads. The least recently used statements are finalized past
+ *        maxStatements.
+ */
+class StatementCache
+{
+public:
+    ~StatementCache()
+    {
+        attach(nullptr, nullptr);
+    }
+
+    sqlite3_stmt* statement(QSqlDriver* driver, sqlite3* handle, const QString& sql)
+    {
+        if (handle != m_handle)
+            attach(driver, handle);
+
+        if (Statement* cached = m_statements.object(sql))
+            return cached->handle;
+
+        sqlite3_stmt* statement = nullptr;
+        QByteArray utf8 = sql.toUtf8();
+
+        if (sqlite3_prepare_v3(handle, utf8.constData(), utf8.size(), SQLITE_PREPARE_PERSISTENT, &statement, nullptr) != SQLITE_OK) {
+            qCritical() << "Could not prepare SQLite statement:" << sqlite3_errmsg(handle);
+            return nullptr;
+        }
+
+        m_statements.insert(sql, new Statement{statement});
+        return statement;
+    }
+
+    void clear()
+    {
+        m_statements.clear();
+    }
+
+private:
+    struct Statement {
+        sqlite3_stmt* handle;
+
+        ~Statement()
+        {
+            sqlite3_finalize(handle);
+        }
+    };
+
+    static constexpr int maxStatements = 256;
+
+    QCache<QString, Statement> m_statements{maxStatements};
+    sqlite3* m_handle = nullptr;
+    QPointer<QSqlDriver> m_driver;
+
+    void attach(QSqlDriver* driver, sqlite3* handle)
+    {
+        // QSQLITE closes with sqlite3_close, which fails while statements are alive
+        // and leaves the connection open but forgotten by the driver
+        bool abandoned = m_handle != nullptr && !m_statements.isEmpty()
+                         && (m_driver.isNull() || driverHandle(m_driver) != m_handle);
+
+        m_statements.clear();
+
+        if (abandoned)
+            sqlite3_close_v2(m_handle);
+
+        m_handle = handle;
+        m_driver = driver;
+    }
+};
+
+thread_local StatementCache statementCache;
+
+QSqlDriver* connectionDriver()
+{
+    QSqlDatabase database = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+
+    if (!database.isOpen() || database.driverName() != "QSQLITE")
+        return nullptr;
+
+    return driverHandle(database.driver()) != nullptr ? database.driver() : nullptr;
+}
+
+QVariant columnValue(sqlite3_stmt* statement, int column)
+{
+    switch (sqlite3_column_type(statement, column)) {
+    case SQLITE_INTEGER:
+        return QVariant(qlonglong(sqlite3_column_int64(statement, column)));
+    case SQLITE_FLOAT:
+        return QVariant(sqlite3_column_double(statement, column));
+    case SQLITE_TEXT: {
+        auto text = reinterpret_cast<const char*>(sqlite3_column_text(statement, column));
+        return QVariant(QString::fromUtf8(text, sqlite3_column_bytes(statement, column)));
+    }
+    case SQLITE_BLOB: {
+        auto blob = static_cast<const char*>(sqlite3_column_blob(statement, column));
+        return QVariant(QByteArray(blob, sqlite3_column_bytes(statement, column)));
+    }
+    default:
+        return QVariant();
+    }
+}
+
+}
+
+bool SqliteBackend::isAvailable()
+{
+    return isEnabled() && connectionDriver() != nullptr;
+}
+
+bool SqliteBackend::isEnabled()
+{
+    return nativeEnabled;
+}
+
+void SqliteBackend::setEnabled(bool enabled)
+{
+    nativeEnabled = enabled;
+}
+
+bool SqliteBackend::inTransaction()
+{
+    QSqlDriver* driver = connectionDriver();
+    return driver != nullptr && sqlite3_get_autocommit(driverHandle(driver)) == 0;
+}
+
+bool SqliteBackend::selectRow(const QString& sql, model_id_t id, QVariantHash& row)
+{
+    QSqlDriver* driver = connectionDriver();
+
+    if (driver == nullptr)
+        return false;
+
+    sqlite3* handle = driverHandle(driver);
+    sqlite3_stmt* statement = statementCache.statement(driver, handle, sql);
+
+    if (statement == nullptr)
+        return false;
+
+    sqlite3_bind_int64(statement, sqlite3_bind_parameter_index(statement, ":id"), sqlite3_int64(id));
+    int result = sqlite3_step(statement);
+
+    if (result == SQLITE_ROW) {
+        int columnCount = sqlite3_column_count(statement);
+        row.reserve(columnCount);
+
+        for (int i = 0; i < columnCount; ++i)
+            row.insert(QString::fromUtf8(sqlite3_column_name(statement, i)), columnValue(statement, i));
+    } else if (result != SQLITE_DONE) {
+        qCritical() << "Could not execute SQLite statement:" << sqlite3_errmsg(handle);
+    }
+
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+    return result == SQLITE_ROW;
+}
+
+void SqliteBackend::clear()
+{
+    statementCache.clear();
+}
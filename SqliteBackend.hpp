@@ -0,0 +1,62 @@
+#pragma once
+
+#include <QVariantHash>
+#include "Model.hpp"
+
+/**
+ * @brief Executes the Model hot paths directly on the sqlite3 connection handle of
+ *        the default QSQLITE connection, bypassing the QtSql driver. Prepared
+ *        statements are cached per thread and SQL text, up to 256 of them, and
+ *        columns are read with the typed sqlite3 calls.
+ *
+ *        The QSQLITE plugin must be linked against the same SQLite library as this
+ *        library (i.e. Qt built with -system-sqlite), otherwise the handle belongs to
+ *        a different copy of SQLite and must not be used. Cached statements keep
+ *        QSQLITE from closing the connection, so they are finalized, and the
+ *        connection closed, the next time the default connection is used after it
+ *        was closed. Call clear before closing the connection to close it right away.
+ */
+class QTMODELLIBRARY_EXPORT SqliteBackend
+{
+public:
+    /**
+     * @brief Checks whether the native backend is enabled and the default database
+     *        connection is an open QSQLITE connection.
+     * @return true if the Model hot paths should use the native backend.
+     */
+    static bool isAvailable();
+
+    /**
+     * @brief Checks whether the native backend is enabled.
+     * @return true if it's enabled, false otherwise. It's enabled by default.
+     */
+    static bool isEnabled();
+
+    /**
+     * @brief Enables or disables the native backend, e.g. to compare it with the
+     *        QtSql path.
+     * @param enabled Should the Model hot paths use the native backend.
+     */
+    static void setEnabled(bool enabled);
+
+    /**
+     * @brief Executes a SELECT with an :id parameter and reads its first row.
+     * @param sql The SELECT statement.
+     * @param id The value bound to the :id parameter.
+     * @param row Receives the values of the row keyed by column name.
+     * @return true if a row was read, false if there is no such row or on error.
+     */
+    static bool selectRow(const QString& sql, model_id_t id, QVariantHash& row);
+
+    /**
+     * @brief Checks whether a transaction is in progress on the default connection,
+     *        including the ones the application opened.
+     * @return true if the connection isn't in autocommit mode, false otherwise.
+     */
+    static bool inTransaction();
+
+    /**
+     * @brief Finalizes every statement cached for the current thread.
+     */
+    static void clear();
+};
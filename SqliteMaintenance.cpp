@@ -0,0 +1,215 @@
+#include <QMutex>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlDatabase>
+#include <QElapsedTimer>
+#include "SqliteMaintenance.hpp"
+#include "Model.hpp"
+
+namespace {
+
+// Bounds the rows ANALYZE samples per index, hence how long it takes
+constexpr int analysisLimit = 400;
+constexpr int maxVacuumPages = 4096;
+
+QMutex mutex;
+QHash<QString, qint64> writes;
+QElapsedTimer lastWrite;
+
+}
+
+SqliteMaintenance::SqliteMaintenance(QObject* parent)
+    : QObject{parent}
+{
+    m_timer.setInterval(1000);
+    connect(&m_timer, &QTimer::timeout, this, &SqliteMaintenance::runStep);
+}
+
+void SqliteMaintenance::setInterval(int msecs)
+{
+    m_timer.setInterval(msecs);
+}
+
+void SqliteMaintenance::setIdleTime(int msecs)
+{
+    m_idleTime = msecs;
+}
+
+void SqliteMaintenance::setBudget(int msecs)
+{
+    m_budget = qMax(1, msecs);
+}
+
+void SqliteMaintenance::setChurnThreshold(double fraction, qint64 minimumWrites)
+{
+    m_churnFraction = fraction;
+    m_minimumWrites = minimumWrites;
+}
+
+void SqliteMaintenance::start()
+{
+    m_timer.start();
+}
+
+void SqliteMaintenance::stop()
+{
+    m_timer.stop();
+}
+
+void SqliteMaintenance::recordWrite(const QString& table, qint64 rows)
+{
+    QMutexLocker locker(&mutex);
+    writes[table] += qMax<qint64>(1, rows);
+    lastWrite.start();
+}
+
+QHash<QString, qint64> SqliteMaintenance::pendingWrites()
+{
+    QMutexLocker locker(&mutex);
+    return writes;
+}
+
+qint64 SqliteMaintenance::msecsSinceLastWrite()
+{
+    QMutexLocker locker(&mutex);
+    return lastWrite.isValid() ? lastWrite.elapsed() : -1;
+}
+
+void SqliteMaintenance::runStep()
+{
+    QSqlDatabase database = QSqlDatabase::database();
+
+    if (!database.isOpen() || database.driverName() != "QSQLITE")
+        return;
+
+    // The step would keep the transaction's locks longer and be undone by its rollback
+    if (Model::inTransaction())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    analyzeChurnedTable();
+    qint64 budgetLeft = m_budget - timer.elapsed();
+
+    qint64 sinceLastWrite = msecsSinceLastWrite();
+
+    if (budgetLeft > 0 && (sinceLastWrite < 0 || sinceLastWrite >= m_idleTime))
+        vacuum(budgetLeft);
+}
+
+bool SqliteMaintenance::analyzeChurnedTable()
+{
+    const QHash<QString, qint64> pending = pendingWrites();
+
+    // A single table per step keeps each step short
+    for (auto it = pending.cbegin(); it != pending.cend(); ++it) {
+        if (it.value() < m_minimumWrites || it.value() < m_churnFraction * estimatedRows(it.key()))
+            continue;
+
+        QElapsedTimer timer;
+        timer.start();
+        QSqlQuery query;
+
+        // The limit applies to the whole connection, so the application's one is restored
+        if (!query.exec("PRAGMA analysis_limit") || !query.next()) {
+            qWarning() << "Could not read the analysis limit:" << query.lastError().text();
+            return false;
+        }
+
+        int previousLimit = query.value(0).toInt();
+        bool succeeded = query.exec(QString("PRAGMA analysis_limit = %1").arg(analysisLimit))
+                        && query.exec(QString("ANALYZE %1").arg(it.key()));
+
+        if (!succeeded)
+            qWarning() << "Could not analyze" << it.key() << ":" << query.lastError().text();
+
+        if (!query.exec(QString("PRAGMA analysis_limit = %1").arg(previousLimit)))
+            qWarning() << "Could not restore the analysis limit:" << query.lastError().text();
+
+        // Not retried on failure until the table churns again
+        {
+            QMutexLocker locker(&mutex);
+            qint64& count = writes[it.key()];
+            count -= it.value();
+
+            if (count <= 0)
+                writes.remove(it.key());
+        }
+
+        if (succeeded)
+            emit analyzed(it.key(), timer.elapsed());
+
+        return succeeded;
+    }
+
+    return false;
+}
+
+void SqliteMaintenance::vacuum(qint64 budgetLeft)
+{
+    QSqlQuery query;
+
+    if (!query.exec("PRAGMA auto_vacuum") || !query.next())
+        return;
+
+    // 2 is INCREMENTAL
+    if (query.value(0).toInt() != 2) {
+        if (!m_warnedAutoVacuum)
+            qInfo() << "Free pages are not reclaimed: the database doesn't use PRAGMA auto_vacuum = INCREMENTAL";
+
+        m_warnedAutoVacuum = true;
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    int freed = 0;
+
+    while (timer.elapsed() < budgetLeft) {
+        if (!query.exec("PRAGMA freelist_count") || !query.next())
+            break;
+
+        int freePages = query.value(0).toInt();
+
+        if (freePages == 0)
+            break;
+
+        QElapsedTimer step;
+        step.start();
+
+        if (!query.exec(QString("PRAGMA incremental_vacuum(%1)").arg(m_vacuumPages))) {
+            qWarning() << "Could not free pages:" << query.lastError().text();
+            break;
+        }
+
+        while (query.next()) { } // The pages are freed as the statement is stepped
+
+        freed += qMin(freePages, m_vacuumPages);
+        qint64 elapsed = step.elapsed();
+
+        // Keep each step at about a quarter of the budget
+        if (elapsed * 4 < m_budget)
+            m_vacuumPages = qMin(m_vacuumPages * 2, maxVacuumPages);
+        else if (elapsed * 2 > m_budget)
+            m_vacuumPages = qMax(m_vacuumPages / 2, 1);
+    }
+
+    if (freed > 0)
+        emit vacuumed(freed, timer.elapsed());
+}
+
+qint64 SqliteMaintenance::estimatedRows(const QString& table) const
+{
+    QSqlQuery query;
+
+    // Without statistics yet, the minimum number of writes decides alone
+    if (!query.prepare("SELECT stat FROM sqlite_stat1 WHERE tbl = ? LIMIT 1"))
+        return 0;
+
+    query.addBindValue(table);
+
+    if (!query.exec() || !query.next())
+        return 0;
+
+    return query.value(0).toString().section(' ', 0, 0).toLongLong();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <QHash>
+#include <QTimer>
+#include <QObject>
+#include "QtModelLibrary_global.hpp"
+
+/**
+ * @brief Keeps the default SQLite connection in shape from the event loop of the
+ *        thread that uses it: refreshes the query planner statistics of the tables
+ *        that changed significantly, and gives free pages back to the file system in
+ *        small steps while no Model is being written.
+ *
+ *        Every step runs between Model operations and is bounded by a time budget, so
+ *        it never holds the connection (nor the database lock) for longer than that.
+ *        Steps are skipped while a transaction is in progress, which for transactions
+ *        the application opens requires the native SQLite backend to be seen.
+ *        The scheduler is driven by the writes made through Model, which are counted
+ *        per table whether or not a scheduler is running.
+ *
+ *        Freeing pages requires the database to use PRAGMA auto_vacuum = INCREMENTAL,
+ *        which must be set before the first table is created (or be followed by a
+ *        VACUUM).
+ */
+class QTMODELLIBRARY_EXPORT SqliteMaintenance : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SqliteMaintenance(QObject* parent = nullptr);
+
+    /**
+     * @brief Sets how often the scheduler checks whether maintenance is due.
+     *        Defaults to 1 second.
+     */
+    void setInterval(int msecs);
+
+    /**
+     * @brief Sets how long no Model must have been written before pages are freed.
+     *        Defaults to 2 seconds.
+     */
+    void setIdleTime(int msecs);
+
+    /**
+     * @brief Sets the maximum time a single check may spend on maintenance.
+     *        Defaults to 20 milliseconds.
+     */
+    void setBudget(int msecs);
+
+    /**
+     * @brief Sets the churn after which the statistics of a table are refreshed:
+     *        the rows written since the last refresh must reach this fraction of the
+     *        rows of the table and at least minimumWrites. Defaults to 10% and 1000.
+     */
+    void setChurnThreshold(double fraction, qint64 minimumWrites);
+
+    void start();
+    void stop();
+
+    /**
+     * @brief Counts rows written to a table. Called by Model for every write.
+     */
+    static void recordWrite(const QString& table, qint64 rows);
+
+    /**
+     * @brief The rows written to each table since its statistics were last refreshed.
+     */
+    static QHash<QString, qint64> pendingWrites();
+
+    /**
+     * @brief The time since a Model was last written, or -1 if none was written yet.
+     */
+    static qint64 msecsSinceLastWrite();
+
+signals:
+    void analyzed(const QString& table, qint64 msecs);
+    void vacuumed(int pages, qint64 msecs);
+
+private:
+    QTimer m_timer;
+    int m_idleTime{2000};
+    int m_budget{20};
+    double m_churnFraction{0.1};
+    qint64 m_minimumWrites{1000};
+    int m_vacuumPages{64}; ///< Pages freed per step, adapted to the budget
+    bool m_warnedAutoVacuum{false};
+
+    void runStep();
+    bool analyzeChurnedTable();
+    void vacuum(qint64 budgetLeft);
+    qint64 estimatedRows(const QString& table) const;
+};
@@ -0,0 +1,171 @@
+#include <QThread>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlDatabase>
+#include <QElapsedTimer>
+#include "WalCheckpointer.hpp"
+#include "SqliteMaintenance.hpp"
+
+WalCheckpointer::~WalCheckpointer()
+{
+    stop();
+}
+
+void WalCheckpointer::setInterval(int msecs)
+{
+    QMutexLocker locker(&m_mutex);
+    m_interval = qMax(1, msecs);
+}
+
+void WalCheckpointer::setRestartThreshold(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_restartThreshold = bytes;
+}
+
+void WalCheckpointer::setIdleTime(int msecs)
+{
+    QMutexLocker locker(&m_mutex);
+    m_idleTime = msecs;
+}
+
+bool WalCheckpointer::start()
+{
+    if (m_thread != nullptr)
+        return true;
+
+    QSqlDatabase database = QSqlDatabase::database();
+
+    if (!database.isOpen() || database.driverName() != "QSQLITE") {
+        qWarning() << "WAL checkpoints can only be managed on an open QSQLITE default connection";
+        return false;
+    }
+
+    QSqlQuery query;
+
+    if (!query.exec("PRAGMA journal_mode") || !query.next()
+        || query.value(0).toString().compare("wal", Qt::CaseInsensitive) != 0) {
+        qWarning() << "The database doesn't use PRAGMA journal_mode = WAL";
+        return false;
+    }
+
+    // Restored by stop, the application may have tuned it
+    if (!query.exec("PRAGMA wal_autocheckpoint") || !query.next()) {
+        qCritical() << "Could not read the automatic checkpoint setting:" << query.lastError().text();
+        return false;
+    }
+
+    m_previousAutocheckpoint = query.value(0).toInt();
+
+    if (!query.exec("PRAGMA wal_autocheckpoint = 0")) {
+        qCritical() << "Could not disable automatic checkpoints:" << query.lastError().text();
+        return false;
+    }
+
+    m_stopping = false;
+    QString connectionName = QString("QtModelLibrary_wal_checkpointer_%1").arg(quintptr(this));
+    m_thread = QThread::create([this, connectionName]() { run(connectionName); });
+    m_thread->start(QThread::LowPriority);
+    return true;
+}
+
+void WalCheckpointer::stop()
+{
+    if (m_thread == nullptr)
+        return;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_wake.wakeAll();
+    }
+
+    m_thread->wait();
+    delete m_thread;
+    m_thread = nullptr;
+
+    if (!QSqlDatabase::database(QLatin1String(QSqlDatabase::defaultConnection), false).isOpen())
+        return;
+
+    QSqlQuery query;
+
+    if (!query.exec(QString("PRAGMA wal_autocheckpoint = %1").arg(m_previousAutocheckpoint)))
+        qWarning() << "Could not restore automatic checkpoints:" << query.lastError().text();
+}
+
+WalCheckpointer::Metrics WalCheckpointer::metrics() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_metrics;
+}
+
+void WalCheckpointer::run(const QString& connectionName)
+{
+    {
+        QSqlDatabase database = QSqlDatabase::cloneDatabase(QLatin1String(QSqlDatabase::defaultConnection), connectionName);
+
+        if (!database.open()) {
+            qCritical() << "Could not open the checkpoint connection:" << database.lastError().text();
+        } else {
+            QSqlQuery query(database);
+            qint64 pageSize = 4096;
+
+            // RESTART holds new writers back while it waits for readers, so it mustn't wait long
+            query.exec("PRAGMA busy_timeout = 10");
+
+            if (query.exec("PRAGMA page_size") && query.next())
+                pageSize = query.value(0).toLongLong();
+
+            query.finish();
+            QMutexLocker locker(&m_mutex);
+
+            while (!m_stopping) {
+                m_wake.wait(&m_mutex, m_interval);
+
+                if (m_stopping)
+                    break;
+
+                locker.unlock();
+                checkpoint(database, pageSize);
+                locker.relock();
+            }
+        }
+    }
+
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+void WalCheckpointer::checkpoint(QSqlDatabase& database, qint64 pageSize)
+{
+    bool restart = false;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        qint64 sinceLastWrite = SqliteMaintenance::msecsSinceLastWrite();
+        bool idle = sinceLastWrite < 0 || sinceLastWrite >= m_idleTime;
+        restart = idle && m_metrics.walBytes >= m_restartThreshold;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QSqlQuery query(database);
+
+    // Reports whether it was blocked, the frames in the WAL and the frames checkpointed
+    if (!query.exec(QString("PRAGMA wal_checkpoint(%1)").arg(restart ? "RESTART" : "PASSIVE")) || !query.next()) {
+        qWarning() << "Could not checkpoint the WAL:" << query.lastError().text();
+        return;
+    }
+
+    bool busy = query.value(0).toInt() != 0;
+    qint64 frames = qMax<qint64>(0, query.value(1).toLongLong());
+    qint64 duration = timer.nsecsElapsed() / 1000;
+    QMutexLocker locker(&m_mutex);
+    // After a RESTART the next writer starts the WAL over
+    m_metrics.walBytes = restart && !busy ? 0 : frames * pageSize;
+    m_metrics.checkpoints += 1;
+    m_metrics.restarts += restart && !busy ? 1 : 0;
+    m_metrics.busy += busy ? 1 : 0;
+    m_metrics.lastDurationUsecs = duration;
+    m_metrics.maxDurationUsecs = qMax(m_metrics.maxDurationUsecs, duration);
+    m_metrics.totalDurationUsecs += duration;
+}
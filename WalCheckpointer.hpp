@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include "QtModelLibrary_global.hpp"
+
+class QThread;
+class QSqlDatabase;
+
+/**
+ * @brief Moves the WAL checkpoints of the default SQLite connection out of the write
+ *        path. SQLite normally checkpoints inside whichever commit makes the WAL cross
+ *        wal_autocheckpoint pages, and that commit stalls for the whole checkpoint.
+ *        Once started, automatic checkpoints are disabled and a background thread, on
+ *        its own connection, runs a PASSIVE checkpoint every interval, which never
+ *        waits for nor blocks readers and writers. When the WAL still grew past the
+ *        restart threshold (readers kept it from being checkpointed) and no Model was
+ *        written for the idle time, a RESTART checkpoint lets the next writer reuse
+ *        the WAL from its beginning so it stops growing.
+ *
+ *        The database must be a file using PRAGMA journal_mode = WAL.
+ */
+class QTMODELLIBRARY_EXPORT WalCheckpointer
+{
+public:
+    struct Metrics {
+        qint64 walBytes{0};          ///< Size of the WAL content after the last checkpoint
+        qint64 checkpoints{0};
+        qint64 restarts{0};
+        qint64 busy{0};              ///< Checkpoints that couldn't complete
+        qint64 lastDurationUsecs{0};
+        qint64 maxDurationUsecs{0};
+        qint64 totalDurationUsecs{0};
+    };
+
+    WalCheckpointer() = default;
+    ~WalCheckpointer();
+
+    /**
+     * @brief Sets how often a PASSIVE checkpoint runs. Defaults to 200 milliseconds.
+     */
+    void setInterval(int msecs);
+
+    /**
+     * @brief Sets the WAL size past which a RESTART checkpoint runs when idle.
+     *        Defaults to 64 MiB.
+     */
+    void setRestartThreshold(qint64 bytes);
+
+    /**
+     * @brief Sets how long no Model must have been written before a RESTART
+     *        checkpoint runs. Defaults to 1 second.
+     */
+    void setIdleTime(int msecs);
+
+    /**
+     * @brief Disables automatic checkpoints on the default connection and starts the
+     *        background thread. Must be called from the thread of the default connection.
+     * @return true if the checkpoints are managed, false otherwise.
+     */
+    bool start();
+
+    /**
+     * @brief Stops the background thread and restores the wal_autocheckpoint value
+     *        found by start. Must be called from the thread of the default connection.
+     */
+    void stop();
+
+    Metrics metrics() const;
+
+private:
+    Q_DISABLE_COPY(WalCheckpointer)
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_wake;
+    QThread* m_thread{nullptr};
+    bool m_stopping{false};
+    int m_interval{200};
+    qint64 m_restartThreshold{64 * 1024 * 1024};
+    int m_idleTime{1000};
+    int m_previousAutocheckpoint{1000};
+    Metrics m_metrics;
+
+    void run(const QString& connectionName);
+    void checkpoint(QSqlDatabase& database, qint64 pageSize);
+};
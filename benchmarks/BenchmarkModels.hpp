@@ -0,0 +1,110 @@
+#pragma once
+
+#include <QDate>
+#include "Model.hpp"
+
+/**
+ * @brief The related Model of the benchmark schema.
+ */
+class Address : public Model
+{
+    Q_OBJECT
+    Q_PROPERTY(QString street READ street WRITE setStreet NOTIFY streetChanged FINAL)
+    Q_PROPERTY(QString city READ city WRITE setCity NOTIFY cityChanged FINAL)
+
+public:
+    Q_INVOKABLE explicit Address(QObject* parent = nullptr) : Model{parent} { }
+
+    QString street() const { return m_street; }
+    void setStreet(const QString& street)
+    {
+        if (street == m_street)
+            return;
+
+        m_street = street;
+        setModified("street");
+        emit streetChanged();
+    }
+
+    QString city() const { return m_city; }
+    void setCity(const QString& city)
+    {
+        if (city == m_city)
+            return;
+
+        m_city = city;
+        setModified("city");
+        emit cityChanged();
+    }
+
+signals:
+    void streetChanged();
+    void cityChanged();
+
+protected:
+    inline QString tableName() const override { return "addresses"; }
+
+private:
+    QString m_street;
+    QString m_city;
+};
+
+/**
+ * @brief The Model measured by the benchmark, as declared in the README.
+ */
+class Person : public Model
+{
+    Q_OBJECT
+    Q_PROPERTY(QString fullName READ fullName WRITE setFullName NOTIFY fullNameChanged FINAL)
+    Q_PROPERTY(QDate birth READ birth WRITE setBirth NOTIFY birthChanged FINAL)
+    Q_PROPERTY(Address* address READ address WRITE setAddress NOTIFY addressChanged FINAL)
+
+public:
+    Q_INVOKABLE explicit Person(QObject* parent = nullptr) : Model{parent} { }
+
+    QString fullName() const { return m_fullName; }
+    void setFullName(const QString& fullName)
+    {
+        if (fullName == m_fullName)
+            return;
+
+        m_fullName = fullName;
+        setModified("fullName");
+        emit fullNameChanged();
+    }
+
+    QDate birth() const { return m_birth; }
+    void setBirth(const QDate& birth)
+    {
+        if (birth == m_birth)
+            return;
+
+        m_birth = birth;
+        setModified("birth");
+        emit birthChanged();
+    }
+
+    Address* address() const { return m_address; }
+    void setAddress(Address* address)
+    {
+        if (address == m_address)
+            return;
+
+        m_address = address;
+        setModified("address");
+        emit addressChanged();
+    }
+
+signals:
+    void fullNameChanged();
+    void birthChanged();
+    void addressChanged();
+
+protected:
+    inline QString tableName() const override { return "people"; }
+
+private:
+    QString m_fullName;
+    QDate m_birth;
+    Address* m_address{nullptr};
+};
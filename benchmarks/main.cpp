@@ -0,0 +1,548 @@
+#include <QBuffer>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QSqlDatabase>
+#include <QTemporaryDir>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QCoreApplication>
+#include "BenchmarkModels.hpp"
+#include "MemoryStorage.hpp"
+#include "MappedStorage.hpp"
+#include "ModelStream.hpp"
+
+#ifdef QTMODELLIBRARY_NATIVE_SQLITE
+#include "SqliteBackend.hpp"
+#endif
+
+namespace {
+
+QTextStream out(stdout);
+
+/**
+ * @brief The cost of one operation, in nanoseconds, measured three ways.
+ */
+struct Measurement {
+    double raw;           ///< Hand-written QSqlQuery, prepared once and reused
+    double rawUnprepared; ///< Hand-written QSqlQuery, prepared on every call like Model does
+    double model;         ///< The Model operation
+};
+
+/**
+ * @brief Runs an operation the given number of times.
+ * @return The average duration of the operation in nanoseconds.
+ */
+template<typename Operation>
+double measure(int iterations, Operation&& operation)
+{
+    if (iterations <= 0)
+        return 0;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < iterations; ++i)
+        operation(i);
+
+    return double(timer.nsecsElapsed()) / iterations;
+}
+
+/**
+ * @brief Prints the overhead of a Model operation over raw QtSql, broken down by
+ *        phase: executing the statement (what raw QtSql costs at best), preparing it
+ *        on every call, and mapping the row to and from properties through the
+ *        meta-object system.
+ */
+void report(const QString& operation, const Measurement& measurement)
+{
+    double prepare = qMax(0.0, measurement.rawUnprepared - measurement.raw);
+    double mapping = qMax(0.0, measurement.model - measurement.rawUnprepared);
+    auto percentOfModel = [&measurement](double phase) {
+        return QString::number(100 * phase / measurement.model, 'f', 1) + "%";
+    };
+
+    out << qSetFieldWidth(16) << Qt::left << operation << Qt::right
+        << QString::number(measurement.raw, 'f', 0)
+        << QString::number(measurement.model, 'f', 0)
+        << QString::number(100 * (measurement.model - measurement.raw) / measurement.raw, 'f', 1) + "%"
+        << percentOfModel(measurement.raw) << percentOfModel(prepare) << percentOfModel(mapping)
+        << qSetFieldWidth(0) << Qt::endl;
+}
+
+bool exec(QSqlQuery& query)
+{
+    if (!query.exec()) {
+        qCritical() << "Could not execute benchmark query:" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+bool createSchema(int rows)
+{
+    QSqlQuery query;
+    QStringList statements{
+        "CREATE TABLE addresses (id INTEGER PRIMARY KEY AUTOINCREMENT, street TEXT, city TEXT)",
+        "CREATE TABLE people (id INTEGER PRIMARY KEY AUTOINCREMENT, fullName TEXT, birth TEXT, address INTEGER)",
+    };
+
+    for (const QString& statement : statements) {
+        if (!query.exec(statement)) {
+            qCritical() << "Could not create the benchmark schema:" << query.lastError().text();
+            return false;
+        }
+    }
+
+    QSqlDatabase::database().transaction();
+    QSqlQuery address, person;
+    address.prepare("INSERT INTO addresses (street, city) VALUES (?, ?)");
+    person.prepare("INSERT INTO people (fullName, birth, address) VALUES (?, ?, ?)");
+
+    for (int i = 1; i <= rows; ++i) {
+        address.bindValue(0, QString("%1 Main Street").arg(i));
+        address.bindValue(1, "Curitiba");
+        person.bindValue(0, QString("Person %1").arg(i));
+        person.bindValue(1, QDate(1970, 1, 1).addDays(i));
+        person.bindValue(2, i);
+
+        if (!exec(address) || !exec(person))
+            return false;
+    }
+
+    return QSqlDatabase::database().commit();
+}
+
+/**
+ * @brief Inserts rows to be deleted by the delete benchmark.
+ * @return The id of the first inserted row.
+ */
+model_id_t insertDisposableRows(int rows)
+{
+    QSqlQuery query;
+    query.prepare("INSERT INTO people (fullName, birth, address) VALUES ('Disposable', '2000-01-01', 1)");
+    QSqlDatabase::database().transaction();
+    model_id_t first = 0;
+
+    for (int i = 0; i < rows && exec(query); ++i) {
+        if (first == 0)
+            first = query.lastInsertId().toULongLong();
+    }
+
+    QSqlDatabase::database().commit();
+    return first;
+}
+
+QList<Person*> loadPeople(model_id_t first, int count)
+{
+    QList<Person*> people;
+
+    for (int i = 0; i < count; ++i) {
+        auto person = new Person;
+        person->load(first + i, false);
+        people << person;
+    }
+
+    return people;
+}
+
+Measurement benchmarkLoad(int iterations)
+{
+    QString sql("SELECT fullName, birth, address FROM people WHERE id = ?");
+    auto read = [](QSqlQuery& query, Person& person) {
+        person.setFullName(query.value(0).toString());
+        person.setBirth(query.value(1).toDate());
+        person.setProperty("address_id", query.value(2));
+    };
+
+    QSqlQuery prepared;
+    prepared.prepare(sql);
+    Measurement measurement;
+
+    measurement.raw = measure(iterations, [&](int i) {
+        Person person;
+        prepared.bindValue(0, i + 1);
+
+        if (exec(prepared) && prepared.next())
+            read(prepared, person);
+    });
+
+    measurement.rawUnprepared = measure(iterations, [&](int i) {
+        Person person;
+        QSqlQuery query;
+        query.prepare(sql);
+        query.bindValue(0, i + 1);
+
+        if (exec(query) && query.next())
+            read(query, person);
+    });
+
+    measurement.model = measure(iterations, [](int i) {
+        Person person;
+        person.load(i + 1, false);
+    });
+
+    return measurement;
+}
+
+Measurement benchmarkLoadRelated(int iterations)
+{
+    QString sql("SELECT p.fullName, p.birth, a.street, a.city FROM people p "
+                "LEFT JOIN addresses a ON a.id = p.address WHERE p.id = ?");
+    auto read = [](QSqlQuery& query, Person& person) {
+        auto address = new Address(&person);
+        address->setStreet(query.value(2).toString());
+        address->setCity(query.value(3).toString());
+        person.setFullName(query.value(0).toString());
+        person.setBirth(query.value(1).toDate());
+        person.setAddress(address);
+    };
+
+    QSqlQuery prepared;
+    prepared.prepare(sql);
+    Measurement measurement;
+
+    measurement.raw = measure(iterations, [&](int i) {
+        Person person;
+        prepared.bindValue(0, i + 1);
+
+        if (exec(prepared) && prepared.next())
+            read(prepared, person);
+    });
+
+    measurement.rawUnprepared = measure(iterations, [&](int i) {
+        Person person;
+        QSqlQuery query;
+        query.prepare(sql);
+        query.bindValue(0, i + 1);
+
+        if (exec(query) && query.next())
+            read(query, person);
+    });
+
+    measurement.model = measure(iterations, [](int i) {
+        Person person;
+        person.load(i + 1, true);
+        delete person.address();
+    });
+
+    return measurement;
+}
+
+Measurement benchmarkInsert(int iterations)
+{
+    QString sql("INSERT INTO people (fullName, birth, address) VALUES (?, ?, ?)");
+    Address address;
+    address.load(1, false);
+    auto bind = [](QSqlQuery& query, int i) {
+        query.bindValue(0, QString("Inserted %1").arg(i));
+        query.bindValue(1, QDate(1990, 1, 1));
+        query.bindValue(2, 1);
+    };
+
+    QSqlQuery prepared;
+    prepared.prepare(sql);
+    Measurement measurement;
+
+    measurement.raw = measure(iterations, [&](int i) {
+        bind(prepared, i);
+
+        if (exec(prepared))
+            prepared.lastInsertId();
+    });
+
+    measurement.rawUnprepared = measure(iterations, [&](int i) {
+        QSqlQuery query;
+        query.prepare(sql);
+        bind(query, i);
+
+        if (exec(query))
+            query.lastInsertId();
+    });
+
+    measurement.model = measure(iterations, [&address](int i) {
+        Person person;
+        person.setFullName(QString("Inserted %1").arg(i));
+        person.setBirth(QDate(1990, 1, 1));
+        person.setAddress(&address);
+        person.insert();
+        person.setAddress(nullptr);
+    });
+
+    return measurement;
+}
+
+Measurement benchmarkUpdate(int iterations)
+{
+    QString sql("UPDATE people SET fullName = ? WHERE id = ?");
+    QSqlQuery prepared;
+    prepared.prepare(sql);
+    Measurement measurement;
+
+    measurement.raw = measure(iterations, [&](int i) {
+        prepared.bindValue(0, QString("Raw %1").arg(i));
+        prepared.bindValue(1, i + 1);
+        exec(prepared);
+    });
+
+    measurement.rawUnprepared = measure(iterations, [&](int i) {
+        QSqlQuery query;
+        query.prepare(sql);
+        query.bindValue(0, QString("Unprepared %1").arg(i));
+        query.bindValue(1, i + 1);
+        exec(query);
+    });
+
+    // Loading is not part of the measured update
+    QList<Person*> people = loadPeople(1, iterations);
+
+    measurement.model = measure(iterations, [&people](int i) {
+        people.at(i)->setFullName(QString("Model %1").arg(i));
+        people.at(i)->update();
+    });
+
+    qDeleteAll(people);
+    return measurement;
+}
+
+Measurement benchmarkDelete(int iterations)
+{
+    QString sql("DELETE FROM people WHERE id = ?");
+    QSqlQuery prepared;
+    prepared.prepare(sql);
+    Measurement measurement;
+    model_id_t first = insertDisposableRows(iterations);
+
+    measurement.raw = measure(iterations, [&](int i) {
+        prepared.bindValue(0, first + i);
+        exec(prepared);
+    });
+
+    first = insertDisposableRows(iterations);
+
+    measurement.rawUnprepared = measure(iterations, [&](int i) {
+        QSqlQuery query;
+        query.prepare(sql);
+        query.bindValue(0, first + i);
+        exec(query);
+    });
+
+    QList<Person*> people = loadPeople(insertDisposableRows(iterations), iterations);
+
+    measurement.model = measure(iterations, [&people](int i) {
+        people.at(i)->deleteFromDatabase();
+    });
+
+    // deleteFromDatabase calls deleteLater on the deleted Models
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+    return measurement;
+}
+
+/**
+ * @brief Measures Model insert and load against the SQL database when Person is
+ *        kept in the given storage.
+ */
+void benchmarkStorage(const QString& name, ModelStorage* storage, int iterations)
+{
+    QList<model_id_t> ids;
+    ModelStorage::setStorage(Person::staticMetaObject, storage);
+
+    double insert = measure(iterations, [&ids](int i) {
+        Person person;
+        person.setFullName(QString("Stored %1").arg(i));
+        person.setBirth(QDate(1990, 1, 1));
+
+        if (person.insert())
+            ids << person.id();
+    });
+
+    double load = measure(ids.size(), [&ids](int i) {
+        Person person;
+        person.load(ids.at(i), false);
+    });
+
+    ModelStorage::setStorage(Person::staticMetaObject, nullptr);
+    out << qSetFieldWidth(24) << Qt::left << name << Qt::right << qSetFieldWidth(16)
+        << QString::number(insert, 'f', 0) << QString::number(load, 'f', 0) << qSetFieldWidth(0) << Qt::endl;
+}
+
+void reportWireFormat(const QString& name, int count, double encode, double decode, qsizetype bytes)
+{
+    out << qSetFieldWidth(24) << Qt::left << name << Qt::right << qSetFieldWidth(16)
+        << QString::number(encode / count, 'f', 0) << QString::number(decode / count, 'f', 0)
+        << QString::number(double(bytes) / count, 'f', 1) << qSetFieldWidth(0) << Qt::endl;
+}
+
+/**
+ * @brief Encodes and decodes the same Models as JSON, with QDataStream and with
+ *        ModelWriter and ModelReader.
+ */
+void benchmarkWireFormats(int count)
+{
+    QList<Person*> people;
+
+    for (int i = 0; i < count; ++i) {
+        auto person = new Person;
+        person->setFullName(QString("Person %1").arg(i % 100)); // Names repeat, like real data
+        person->setBirth(QDate(1970, 1, 1).addDays(i));
+        person->setProperty("addressId", qlonglong(i + 1));
+        people << person;
+    }
+
+    QByteArray json;
+    double encode = measure(1, [&](int) {
+        QJsonArray array;
+
+        for (const Person* person : std::as_const(people)) {
+            array.append(QJsonObject{{"id", qint64(person->id())}, {"fullName", person->fullName()},
+                                     {"birth", person->birth().toString(Qt::ISODate)},
+                                     {"address", person->property("addressId").toLongLong()}});
+        }
+
+        json = QJsonDocument(array).toJson(QJsonDocument::Compact);
+    });
+    double decode = measure(1, [&](int) {
+        const QJsonArray array = QJsonDocument::fromJson(json).array();
+
+        for (const QJsonValue& value : array) {
+            Person person;
+            person.setFullName(value["fullName"].toString());
+            person.setBirth(QDate::fromString(value["birth"].toString(), Qt::ISODate));
+            person.setProperty("addressId", value["address"].toInteger());
+        }
+    });
+    reportWireFormat("JSON", count, encode, decode, json.size());
+
+    QByteArray stream;
+    encode = measure(1, [&](int) {
+        QDataStream output(&stream, QIODevice::WriteOnly);
+
+        for (const Person* person : std::as_const(people))
+            output << person->id() << person->fullName() << person->birth() << person->property("addressId").toLongLong();
+    });
+    decode = measure(1, [&](int) {
+        QDataStream input(stream);
+
+        for (int i = 0; i < count; ++i) {
+            Person person;
+            model_id_t id;
+            QString fullName;
+            QDate birth;
+            qlonglong address;
+            input >> id >> fullName >> birth >> address;
+            person.setFullName(fullName);
+            person.setBirth(birth);
+            person.setProperty("addressId", address);
+        }
+    });
+    reportWireFormat("QDataStream", count, encode, decode, stream.size());
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    encode = measure(1, [&](int) {
+        ModelWriter writer(&buffer);
+
+        for (const Person* person : std::as_const(people))
+            writer.write(person);
+    });
+    decode = measure(1, [&](int) {
+        buffer.seek(0);
+        ModelReader reader(&buffer, Person::staticMetaObject);
+
+        while (Model* person = reader.next())
+            delete person;
+    });
+    reportWireFormat("ModelWriter", count, encode, decode, buffer.size());
+
+    // Reads a single column straight from the frames
+    qsizetype nameBytes = 0;
+    decode = measure(1, [&](int) {
+        buffer.seek(0);
+        ModelReader reader(&buffer, Person::staticMetaObject);
+        ModelRowView row;
+
+        while (reader.nextRow(row))
+            nameBytes += row.utf8("fullName").size();
+    });
+    reportWireFormat("ModelRowView (name)", count, encode, decode, buffer.size());
+    qDeleteAll(people);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList arguments = app.arguments();
+    int iterations = arguments.size() > 1 ? arguments.at(1).toInt() : 2000;
+    QString databaseName = arguments.size() > 2 ? arguments.at(2) : QString(":memory:");
+
+    if (iterations <= 0) {
+        qCritical() << "Usage:" << arguments.first() << "[iterations] [SQLite database file]";
+        return 1;
+    }
+
+    QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE");
+    database.setDatabaseName(databaseName);
+
+    if (!database.open()) {
+        qCritical() << "Could not open the benchmark database:" << database.lastError().text();
+        return 1;
+    }
+
+    if (!createSchema(iterations))
+        return 1;
+
+    out << "QtModelLibrary overhead over raw QtSql, " << iterations << " iterations on " << databaseName << Qt::endl;
+#ifdef QTMODELLIBRARY_NATIVE_SQLITE
+    out << "Native SQLite backend: " << (SqliteBackend::isAvailable() ? "enabled" : "not available") << Qt::endl;
+#else
+    out << "Native SQLite backend: disabled" << Qt::endl;
+#endif
+    out << Qt::endl << "Times in ns per operation. Phases are shares of the Model time." << Qt::endl;
+    out << qSetFieldWidth(16) << Qt::left << "operation" << Qt::right
+        << "raw" << "model" << "overhead" << "execute" << "prepare" << "mapping" << qSetFieldWidth(0) << Qt::endl;
+
+    report("load", benchmarkLoad(iterations));
+    report("load related", benchmarkLoadRelated(iterations));
+    report("insert", benchmarkInsert(iterations));
+    report("update", benchmarkUpdate(iterations));
+    report("delete", benchmarkDelete(iterations));
+
+#ifdef QTMODELLIBRARY_NATIVE_SQLITE
+    if (SqliteBackend::isAvailable()) {
+        SqliteBackend::setEnabled(false);
+        Measurement qtSql = benchmarkLoad(iterations);
+        SqliteBackend::setEnabled(true);
+        out << Qt::endl << "load through QtSql instead of sqlite3: " << QString::number(qtSql.model, 'f', 0)
+            << " ns" << Qt::endl;
+    }
+#endif
+
+    QTemporaryDir directory;
+    MemoryStorage memory;
+    MappedStorage mapped(directory.filePath("people.log"), false);
+    MappedStorage mappedSynced(directory.filePath("people-synced.log"));
+
+    out << Qt::endl << "Model storages, in ns per operation." << Qt::endl;
+    out << qSetFieldWidth(24) << Qt::left << "storage" << Qt::right << qSetFieldWidth(16)
+        << "insert" << "load" << qSetFieldWidth(0) << Qt::endl;
+    benchmarkStorage(QString("SQL (%1)").arg(database.driverName()), nullptr, iterations);
+    benchmarkStorage("MemoryStorage", &memory, iterations);
+
+    if (mapped.open())
+        benchmarkStorage("MappedStorage", &mapped, iterations);
+
+    if (mappedSynced.open())
+        benchmarkStorage("MappedStorage (fsync)", &mappedSynced, iterations);
+
+    out << Qt::endl << "Wire formats, in ns and bytes per Model." << Qt::endl;
+    out << qSetFieldWidth(24) << Qt::left << "format" << Qt::right << qSetFieldWidth(16)
+        << "encode" << "decode" << "bytes" << qSetFieldWidth(0) << Qt::endl;
+    benchmarkWireFormats(iterations);
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <QtTest>
+#include <QUrl>
+#include <QSqlQuery>
+#include <QSqlDatabase>
+#include "PostgresBackend.hpp"
+#include "TestModels.hpp"
+
+/**
+ * @brief Inserts Models with PostgresBackend::copyInsert into the server of
+ *        QTMODELLIBRARY_TEST_POSTGRES.
+ */
+class CopyInsertTest : public QObject
+{
+    Q_OBJECT
+
+    bool m_connected{false};
+
+    static qlonglong count(const QString& table)
+    {
+        QSqlQuery query;
+        return query.exec(QString("SELECT count(*) FROM %1").arg(table)) && query.next() ? query.value(0).toLongLong() : -1;
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QUrl url(qEnvironmentVariable("QTMODELLIBRARY_TEST_POSTGRES"));
+
+        if (url.isEmpty())
+            QSKIP("Set QTMODELLIBRARY_TEST_POSTGRES to a postgresql:// URL to run the PostgreSQL tests");
+
+        QSqlDatabase database = QSqlDatabase::addDatabase("QPSQL");
+        database.setHostName(url.host());
+        database.setPort(url.port(5432));
+        database.setDatabaseName(url.path().mid(1));
+        database.setUserName(url.userName());
+        database.setPassword(url.password());
+        QVERIFY(database.open());
+        QVERIFY(PostgresBackend::isAvailable());
+        m_connected = true;
+
+        QSqlQuery query;
+        QVERIFY(query.exec("DROP TABLE IF EXISTS people, addresses, orders, customers"));
+        QVERIFY(query.exec("CREATE TABLE addresses (id BIGSERIAL PRIMARY KEY, street TEXT, city TEXT)"));
+        QVERIFY(query.exec("CREATE TABLE people (id BIGSERIAL PRIMARY KEY, fullName TEXT CHECK (length(fullName) < 20),"
+                           " birth DATE, address BIGINT REFERENCES addresses (id))"));
+        QVERIFY(query.exec("CREATE TABLE customers (id BIGSERIAL PRIMARY KEY, name TEXT,"
+                           " orderCount INTEGER NOT NULL DEFAULT 0, orderTotal DOUBLE PRECISION NOT NULL DEFAULT 0)"));
+        QVERIFY(query.exec("CREATE TABLE orders (id BIGSERIAL PRIMARY KEY, customer BIGINT REFERENCES customers (id),"
+                           " amount DOUBLE PRECISION)"));
+    }
+
+    void init()
+    {
+        QSqlQuery query;
+        QVERIFY(query.exec("TRUNCATE people, addresses, orders, customers"));
+    }
+
+    void cleanupTestCase()
+    {
+        if (!m_connected)
+            return;
+
+        QSqlQuery("DROP TABLE IF EXISTS people, addresses, orders, customers").exec();
+        QSqlDatabase::database().close();
+    }
+
+    void assignsIds()
+    {
+        Address address;
+        address.setStreet("Baker Street");
+        Person people[3];
+        QList<Model*> models;
+
+        for (int i = 0; i < 3; ++i) {
+            people[i].setFullName(QString("Person %1").arg(i));
+            people[i].setBirth(QDate(1815, 12, 10));
+            models << &people[i];
+        }
+
+        people[0].setAddress(&address);
+        QVERIFY(PostgresBackend::copyInsert(models));
+
+        QVERIFY(address.isSaved());
+        QSet<model_id_t> ids;
+
+        for (const Person& person : people) {
+            QVERIFY(person.isSaved());
+            ids.insert(person.id());
+        }
+
+        QCOMPARE(ids.size(), 3);
+        QCOMPARE(count("people"), 3);
+
+        Person loaded;
+        QVERIFY(loaded.load(people[0].id(), false));
+        QCOMPARE(loaded.fullName(), QString("Person 0"));
+        QCOMPARE(loaded.property("addressId").toULongLong(), address.id());
+    }
+
+    void rollsBackOnFailure()
+    {
+        Address address;
+        address.setStreet("Baker Street");
+        Person valid, invalid;
+        valid.setFullName("Ada Lovelace");
+        valid.setAddress(&address);
+        invalid.setFullName("A name longer than the check allows");
+
+        QVERIFY(!PostgresBackend::copyInsert({&valid, &invalid}));
+
+        QVERIFY(!valid.isSaved());
+        QVERIFY(!invalid.isSaved());
+        QVERIFY(!address.isSaved());
+        QCOMPARE(count("people"), 0);
+        QCOMPARE(count("addresses"), 0);
+    }
+
+    void rollsBackToSavepointInApplicationTransaction()
+    {
+        QSqlDatabase database = QSqlDatabase::database();
+        QVERIFY(database.transaction());
+
+        QSqlQuery query;
+        QVERIFY(query.exec("INSERT INTO people (fullName) VALUES ('Grace Hopper')"));
+
+        Person invalid;
+        invalid.setFullName("A name longer than the check allows");
+        QVERIFY(!PostgresBackend::copyInsert({&invalid}));
+
+        // The application's own writes survive and its transaction can still commit
+        QVERIFY(database.commit());
+        QCOMPARE(count("people"), 1);
+    }
+
+    void updatesCounterCaches()
+    {
+        Customer customer;
+        customer.setName("Ada");
+        QVERIFY(customer.insert());
+
+        Order orders[3];
+        const double amounts[] = {1.5, 2.5, 3};
+        QList<Model*> models;
+
+        for (int i = 0; i < 3; ++i) {
+            orders[i].setCustomer(&customer);
+            orders[i].setAmount(amounts[i]);
+            models << &orders[i];
+        }
+
+        QVERIFY(PostgresBackend::copyInsert(models));
+
+        QSqlQuery query;
+        QVERIFY(query.exec(QString("SELECT orderCount, orderTotal FROM customers WHERE id = %1").arg(customer.id())));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toInt(), 3);
+        QCOMPARE(query.value(1).toDouble(), 7.0);
+    }
+};
+
+QTEST_GUILESS_MAIN(CopyInsertTest)
+#include "CopyInsertTest.moc"
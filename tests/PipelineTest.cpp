@@ -0,0 +1,212 @@
+#include <QtTest>
+#include <QUrl>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QThread>
+#include <QPointer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QSqlQuery>
+#include <QSqlDatabase>
+#include "PostgresBackend.hpp"
+#include "TestModels.hpp"
+
+/**
+ * @brief Forwards TCP connections to a server, delaying the data sent in either
+ *        direction to simulate the latency of a remote database. It must live in
+ *        its own thread, since libpq blocks the thread of the test.
+ */
+class DelayProxy : public QObject
+{
+    Q_OBJECT
+
+public:
+    DelayProxy(const QString& host, quint16 port, int delay) : m_host{host}, m_port{port}, m_delay{delay} { }
+
+public slots:
+    /**
+     * @brief Starts accepting connections on a local port.
+     * @return The port, or 0 if it couldn't listen.
+     */
+    quint16 listen()
+    {
+        auto server = new QTcpServer(this);
+
+        if (!server->listen(QHostAddress::LocalHost))
+            return 0;
+
+        connect(server, &QTcpServer::newConnection, this, [this, server]() {
+            while (QTcpSocket* client = server->nextPendingConnection()) {
+                auto upstream = new QTcpSocket(client);
+                upstream->connectToHost(m_host, m_port);
+                relay(client, upstream);
+                relay(upstream, client);
+            }
+        });
+
+        return server->serverPort();
+    }
+
+private:
+    QString m_host;
+    quint16 m_port;
+    int m_delay;
+
+    void relay(QTcpSocket* from, QTcpSocket* to)
+    {
+        QPointer<QTcpSocket> target(to);
+
+        // Timers with the same interval fire in the order they were started
+        connect(from, &QTcpSocket::readyRead, this, [this, from, target]() {
+            QByteArray data = from->readAll();
+            QTimer::singleShot(m_delay, Qt::PreciseTimer, this, [target, data]() {
+                if (target != nullptr)
+                    target->write(data);
+            });
+        });
+
+        connect(from, &QTcpSocket::disconnected, this, [this, target]() {
+            QTimer::singleShot(m_delay, Qt::PreciseTimer, this, [target]() {
+                if (target != nullptr)
+                    target->disconnectFromHost();
+            });
+        });
+    }
+};
+
+/**
+ * @brief Runs PostgresPipeline against the server of QTMODELLIBRARY_TEST_POSTGRES,
+ *        through a proxy that adds latency to every packet.
+ */
+class PipelineTest : public QObject
+{
+    Q_OBJECT
+
+    // One way, so a round trip costs twice as much
+    static constexpr int delay = 50;
+
+    QThread m_proxyThread;
+    DelayProxy* m_proxy{nullptr};
+
+private slots:
+    void initTestCase()
+    {
+        QUrl url(qEnvironmentVariable("QTMODELLIBRARY_TEST_POSTGRES"));
+
+        if (url.isEmpty())
+            QSKIP("Set QTMODELLIBRARY_TEST_POSTGRES to a postgresql:// URL to run the PostgreSQL tests");
+
+        m_proxy = new DelayProxy(url.host(), quint16(url.port(5432)), delay);
+        m_proxy->moveToThread(&m_proxyThread);
+        connect(&m_proxyThread, &QThread::finished, m_proxy, &QObject::deleteLater);
+        m_proxyThread.start();
+
+        quint16 port = 0;
+        QVERIFY(QMetaObject::invokeMethod(m_proxy, "listen", Qt::BlockingQueuedConnection, Q_RETURN_ARG(quint16, port)));
+        QVERIFY(port != 0);
+
+        QSqlDatabase database = QSqlDatabase::addDatabase("QPSQL");
+        database.setHostName("127.0.0.1");
+        database.setPort(port);
+        database.setDatabaseName(url.path().mid(1));
+        database.setUserName(url.userName());
+        database.setPassword(url.password());
+        QVERIFY(database.open());
+        QVERIFY(PostgresBackend::isAvailable());
+
+        QSqlQuery query;
+        QVERIFY(query.exec("DROP TABLE IF EXISTS people, addresses"));
+        QVERIFY(query.exec("CREATE TABLE addresses (id BIGSERIAL PRIMARY KEY, street TEXT, city TEXT)"));
+        QVERIFY(query.exec("CREATE TABLE people (id BIGSERIAL PRIMARY KEY, fullName TEXT CHECK (length(fullName) < 20),"
+                           " birth DATE, address BIGINT REFERENCES addresses (id))"));
+    }
+
+    void init()
+    {
+        QSqlQuery query;
+        QVERIFY(query.exec("DELETE FROM people"));
+
+        for (int id = 1; id <= 20; ++id)
+            QVERIFY(query.exec(QString("INSERT INTO people (id, fullName, birth) VALUES (%1, 'Person %1', '1815-12-10')").arg(id)));
+    }
+
+    void cleanupTestCase()
+    {
+        if (m_proxy == nullptr)
+            return;
+
+        QSqlQuery("DROP TABLE IF EXISTS people, addresses").exec();
+        QSqlDatabase::database().close();
+        m_proxyThread.quit();
+        m_proxyThread.wait();
+    }
+
+    void loadsShareOneRoundTrip()
+    {
+        Person people[20];
+        PostgresPipeline pipeline;
+
+        for (int id = 1; id <= 20; ++id)
+            pipeline.load(&people[id - 1], id);
+
+        QElapsedTimer timer;
+        timer.start();
+        QVERIFY(pipeline.exec());
+
+        // Twenty loads one after the other would take twenty round trips
+        QVERIFY2(timer.elapsed() < 5 * 2 * delay, qPrintable(QString("Took %1 ms").arg(timer.elapsed())));
+
+        for (int id = 1; id <= 20; ++id) {
+            QCOMPARE(people[id - 1].id(), model_id_t(id));
+            QCOMPARE(people[id - 1].fullName(), QString("Person %1").arg(id));
+            QCOMPARE(people[id - 1].birth(), QDate(1815, 12, 10));
+        }
+    }
+
+    void failedUpdateKeepsOthers()
+    {
+        Person first, second, third;
+        QVERIFY(first.load(1));
+        QVERIFY(second.load(2));
+        QVERIFY(third.load(3));
+
+        first.setFullName("Ada Lovelace");
+        second.setFullName("A name longer than the check allows");
+        third.setFullName("Grace Hopper");
+
+        PostgresPipeline pipeline;
+        pipeline.update(&first);
+        pipeline.update(&second);
+        pipeline.update(&third);
+        QVERIFY(!pipeline.exec());
+
+        QSqlQuery query;
+        QVERIFY(query.exec("SELECT fullName FROM people WHERE id <= 3 ORDER BY id"));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toString(), QString("Ada Lovelace"));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toString(), QString("Person 2"));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toString(), QString("Grace Hopper"));
+    }
+
+    void reopenedConnectionPreparesAgain()
+    {
+        Person before;
+        PostgresPipeline pipeline;
+        pipeline.load(&before, 1);
+        QVERIFY(pipeline.exec());
+
+        QSqlDatabase database = QSqlDatabase::database();
+        database.close();
+        QVERIFY(database.open());
+
+        Person after;
+        pipeline.load(&after, 1);
+        QVERIFY(pipeline.exec());
+        QCOMPARE(after.fullName(), QString("Person 1"));
+    }
+};
+
+QTEST_GUILESS_MAIN(PipelineTest)
+#include "PipelineTest.moc"
@@ -0,0 +1,81 @@
+#include <QtTest>
+#include <QSqlQuery>
+#include <QSqlDatabase>
+#include "TestModels.hpp"
+
+/**
+ * @brief Refreshes Models loaded from an in-memory SQLite database after their rows
+ *        are changed behind their back.
+ */
+class RefreshTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase()
+    {
+        QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE");
+        database.setDatabaseName(":memory:");
+        QVERIFY(database.open());
+
+        QSqlQuery query;
+        QVERIFY(query.exec("CREATE TABLE addresses (id INTEGER PRIMARY KEY, street TEXT, city TEXT)"));
+        QVERIFY(query.exec("CREATE TABLE people (id INTEGER PRIMARY KEY, fullName TEXT, birth TEXT, address INTEGER)"));
+    }
+
+    void init()
+    {
+        QSqlQuery query;
+        QVERIFY(query.exec("DELETE FROM people"));
+        QVERIFY(query.exec("INSERT INTO people (id, fullName, birth) VALUES (1, 'Ada', '1815-12-10')"));
+    }
+
+    void loadedModelIsNotModified()
+    {
+        Person person;
+        QVERIFY(person.load(1));
+        QVERIFY(!person.isModified());
+    }
+
+    void refreshReadsChangedRow()
+    {
+        Person person;
+        QVERIFY(person.load(1));
+
+        QSqlQuery query;
+        QVERIFY(query.exec("UPDATE people SET fullName = 'Ada Lovelace' WHERE id = 1"));
+
+        QVERIFY(person.refresh());
+        QCOMPARE(person.fullName(), QString("Ada Lovelace"));
+        QVERIFY(!person.isModified());
+    }
+
+    void refreshKeepsLocalEdits()
+    {
+        Person person;
+        QVERIFY(person.load(1));
+        person.setFullName("Countess of Lovelace");
+
+        QSqlQuery query;
+        QVERIFY(query.exec("UPDATE people SET fullName = 'Ada Lovelace', birth = '1815-12-11' WHERE id = 1"));
+
+        QVERIFY(person.refresh());
+        QCOMPARE(person.fullName(), QString("Countess of Lovelace"));
+        QCOMPARE(person.birth(), QDate(1815, 12, 11));
+        QVERIFY(person.isModified());
+    }
+
+    void refreshFailsForDeletedRow()
+    {
+        Person person;
+        QVERIFY(person.load(1));
+
+        QSqlQuery query;
+        QVERIFY(query.exec("DELETE FROM people WHERE id = 1"));
+
+        QVERIFY(!person.refresh());
+    }
+};
+
+QTEST_GUILESS_MAIN(RefreshTest)
+#include "RefreshTest.moc"
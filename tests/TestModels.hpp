@@ -0,0 +1,190 @@
+#pragma once
+
+#include <QDate>
+#include "Model.hpp"
+
+/**
+ * @brief The related Model of the test schema.
+ */
+class Address : public Model
+{
+    Q_OBJECT
+    Q_PROPERTY(QString street READ street WRITE setStreet NOTIFY streetChanged FINAL)
+    Q_PROPERTY(QString city READ city WRITE setCity NOTIFY cityChanged FINAL)
+
+public:
+    Q_INVOKABLE explicit Address(QObject* parent = nullptr) : Model{parent} { }
+
+    QString street() const { return m_street; }
+    void setStreet(const QString& street)
+    {
+        if (street == m_street)
+            return;
+
+        m_street = street;
+        setModified("street");
+        emit streetChanged();
+    }
+
+    QString city() const { return m_city; }
+    void setCity(const QString& city)
+    {
+        if (city == m_city)
+            return;
+
+        m_city = city;
+        setModified("city");
+        emit cityChanged();
+    }
+
+signals:
+    void streetChanged();
+    void cityChanged();
+
+protected:
+    inline QString tableName() const override { return "addresses"; }
+
+private:
+    QString m_street;
+    QString m_city;
+};
+
+/**
+ * @brief The Model of the tests, as declared in the README.
+ */
+class Person : public Model
+{
+    Q_OBJECT
+    Q_PROPERTY(QString fullName READ fullName WRITE setFullName NOTIFY fullNameChanged FINAL)
+    Q_PROPERTY(QDate birth READ birth WRITE setBirth NOTIFY birthChanged FINAL)
+    Q_PROPERTY(Address* address READ address WRITE setAddress NOTIFY addressChanged FINAL)
+
+public:
+    Q_INVOKABLE explicit Person(QObject* parent = nullptr) : Model{parent} { }
+
+    QString fullName() const { return m_fullName; }
+    void setFullName(const QString& fullName)
+    {
+        if (fullName == m_fullName)
+            return;
+
+        m_fullName = fullName;
+        setModified("fullName");
+        emit fullNameChanged();
+    }
+
+    QDate birth() const { return m_birth; }
+    void setBirth(const QDate& birth)
+    {
+        if (birth == m_birth)
+            return;
+
+        m_birth = birth;
+        setModified("birth");
+        emit birthChanged();
+    }
+
+    Address* address() const { return m_address; }
+    void setAddress(Address* address)
+    {
+        if (address == m_address)
+            return;
+
+        m_address = address;
+        setModified("address");
+        emit addressChanged();
+    }
+
+signals:
+    void fullNameChanged();
+    void birthChanged();
+    void addressChanged();
+
+protected:
+    inline QString tableName() const override { return "people"; }
+
+private:
+    QString m_fullName;
+    QDate m_birth;
+    Address* m_address{nullptr};
+};
+
+/**
+ * @brief The parent of Order, whose orderCount and orderTotal columns are cached.
+ */
+class Customer : public Model
+{
+    Q_OBJECT
+    Q_PROPERTY(QString name READ name WRITE setName NOTIFY nameChanged FINAL)
+
+public:
+    Q_INVOKABLE explicit Customer(QObject* parent = nullptr) : Model{parent} { }
+
+    QString name() const { return m_name; }
+    void setName(const QString& name)
+    {
+        if (name == m_name)
+            return;
+
+        m_name = name;
+        setModified("name");
+        emit nameChanged();
+    }
+
+signals:
+    void nameChanged();
+
+protected:
+    inline QString tableName() const override { return "customers"; }
+
+private:
+    QString m_name;
+};
+
+/**
+ * @brief A child Model with the counter and sum caches of the README.
+ */
+class Order : public Model
+{
+    Q_OBJECT
+    Q_CLASSINFO("counterCache:customer", "orderCount")
+    Q_CLASSINFO("sumCache:customer", "orderTotal=amount")
+    Q_PROPERTY(Customer* customer READ customer WRITE setCustomer NOTIFY customerChanged FINAL)
+    Q_PROPERTY(double amount READ amount WRITE setAmount NOTIFY amountChanged FINAL)
+
+public:
+    Q_INVOKABLE explicit Order(QObject* parent = nullptr) : Model{parent} { }
+
+    Customer* customer() const { return m_customer; }
+    void setCustomer(Customer* customer)
+    {
+        if (customer == m_customer)
+            return;
+
+        m_customer = customer;
+        setModified("customer");
+        emit customerChanged();
+    }
+
+    double amount() const { return m_amount; }
+    void setAmount(double amount)
+    {
+        if (amount == m_amount)
+            return;
+
+        m_amount = amount;
+        setModified("amount");
+        emit amountChanged();
+    }
+
+signals:
+    void customerChanged();
+    void amountChanged();
+
+protected:
+    inline QString tableName() const override { return "orders"; }
+
+private:
+    Customer* m_customer{nullptr};
+    double m_amount{0};
+};